@@ -31,6 +31,8 @@ public:
     df(0,1) = 1;
     df(1,0) = -stiffness/mass;
   }
+
+  LINEARITY linearity() const override { return LINEAR; }
 };
 
 
@@ -8,7 +8,8 @@
 using namespace ASC_ode;
 
 
-class RCCircuit: public NonlinearFunction
+// the source voltage depends on time, which the time steppers pass in
+class RCCircuit: public TimeDependentFunction
 {
 private:
   double R;
@@ -17,29 +18,23 @@ private:
 public:
   RCCircuit(double R_, double C_) : R(R_), C(C_) {}
 
-  size_t dimX() const override { return 2; }
-  size_t dimF() const override { return 2; }
+  size_t dimX() const override { return 1; }
+  size_t dimF() const override { return 1; }
   
-  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  void evaluate (double t, VectorView<double> x, VectorView<double> f) const override
   {
     double Uc = x(0);   // capacitor voltage
-    double t  = x(1);   // time
 
     f(0) = (std::cos(100.0*t*M_PI) - Uc)/(R*C);
-    f(1) = 1.0;
   }
   
-  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  void evaluateDeriv (double t, VectorView<double> x, MatrixView<double> df) const override
   {
-    df = 0.0;
-    //derivatives with respect to the first state variable (Uc)
     df(0,0) = -1.0 / (R * C);
-    df(1,0) = 0.0;
-    //derivative with respect to the second state variable (t)
-    df(0,1) = -100.0 * M_PI * std::sin(100.0 * x(1)) / (R * C);
-    df(1,1) = 0.0;
-
   }
+
+  // the source only shifts f, the Jacobian is the same for all t
+  LINEARITY linearity() const override { return AFFINE; }
 };
 
 
@@ -50,9 +45,9 @@ int main()
   int steps = 50;
   double tau = tend/steps;
 
-  Vector<> y_imp = { 0, 0 }; // initializer list;
-  Vector<> y_exp = { 0, 0 };
-  Vector<> y_crank = { 0, 0 };
+  Vector<> y_imp = { 0 }; // initializer list;
+  Vector<> y_exp = { 0 };
+  Vector<> y_crank = { 0 };
 
   auto rhs = std::make_shared<RCCircuit>(100.0, 10^(-6));
 
@@ -63,33 +58,33 @@ int main()
    CrankNicolson crank_stepper(rhs);
 
   std::ofstream implicit_outfile ("data/ImplicitExercise_17_4_1_mass_RCCircuit.txt");
-  implicit_outfile << 0.0 << "  " << y_imp(0) << " " << y_imp(1) << std::endl;
+  implicit_outfile << 0.0 << "  " << y_imp(0) << std::endl;
 
   for (int i = 0; i < steps; i++)
   {
-     implicit_stepper.DoStep(tau, y_imp);
+     implicit_stepper.DoStep(i*tau, tau, y_imp);
 
-     implicit_outfile << (i+1) * tau << "  " << y_imp(0) << " " << y_imp(1) << std::endl;
+     implicit_outfile << (i+1) * tau << "  " << y_imp(0) << std::endl;
   }
 
 
   std::ofstream explicit_outfile ("data/ExplicitExercise_17_4_1_RCCircuit.txt");
-  explicit_outfile << 0.0 << "  " << y_exp(0) << " " << y_exp(1) << std::endl;
+  explicit_outfile << 0.0 << "  " << y_exp(0) << std::endl;
 
   for (int i = 0; i < steps; i++)
   {
-     explicit_stepper.DoStep(tau, y_exp);
+     explicit_stepper.DoStep(i*tau, tau, y_exp);
 
-     explicit_outfile << (i+1) * tau << "  " << y_exp(0) << " " << y_exp(1) << std::endl;
+     explicit_outfile << (i+1) * tau << "  " << y_exp(0) << std::endl;
   }
 
   std::ofstream crank_outfile ("data/CrankNicolsonExercise_17_4_1_RCCircuit.txt");
-  crank_outfile << 0.0 << "  " << y_crank(0) << " " << y_crank(1) << std::endl;
+  crank_outfile << 0.0 << "  " << y_crank(0) << std::endl;
 
   for (int i = 0; i < steps; i++)
   {
-     crank_stepper.DoStep(tau, y_crank);
+     crank_stepper.DoStep(i*tau, tau, y_crank);
 
-     crank_outfile << (i+1) * tau << "  " << y_crank(0) << " " << y_crank(1) << std::endl;
+     crank_outfile << (i+1) * tau << "  " << y_crank(0) << std::endl;
   }
 }
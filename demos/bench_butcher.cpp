@@ -0,0 +1,105 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+
+using namespace ASC_ode;
+
+
+// stiff  y' = 1 - K y - y^3  with K = diag(1..n) + a dense random coupling
+class StiffCoupling : public NonlinearFunction
+{
+  Matrix<> m_k;
+public:
+  StiffCoupling (size_t n)
+    : m_k(n, n)
+  {
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> dist(0, 1);
+    for (size_t i = 0; i < n; i++)
+      {
+        for (size_t j = 0; j < n; j++)
+          m_k(i,j) = dist(gen) / n;
+        m_k(i,i) += i+1;
+      }
+  }
+
+  size_t dimX() const override { return m_k.rows(); }
+  size_t dimF() const override { return m_k.rows(); }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    size_t n = dimX();
+    for (size_t i = 0; i < n; i++)
+      {
+        double sum = 1 - x(i)*x(i)*x(i);
+        for (size_t j = 0; j < n; j++)
+          sum -= m_k(i,j) * x(j);
+        f(i) = sum;
+      }
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    size_t n = dimX();
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        df(i,j) = -m_k(i,j);
+    for (size_t i = 0; i < n; i++)
+      df(i,i) -= 3*x(i)*x(i);
+  }
+};
+
+
+// Radau IIA with the coupled s n x s n stage system against the
+// Butcher-transformed ceil(s/2) systems of size n, serial and in threads.
+// The step size alternates, as in adaptive stepping, so that every step
+// factorizes anew.
+
+int main()
+{
+  for (int stages : { 3, 5 })
+    {
+      Vector<> c(stages), b1(stages);
+      GaussRadau(c, b1);
+      auto [a, b] = ComputeABfromC(c);
+
+      for (size_t n : { 20, 50, 100, 200 })
+        {
+          auto rhs = std::make_shared<StiffCoupling>(n);
+          std::cout << "Radau IIA(" << stages << "), n = " << n << std::endl;
+
+          Vector<> yref(n);
+          for (std::string mode : { "coupled", "transformed", "transformed, threads" })
+            {
+              if (mode == "coupled" && n*stages > 500) continue;
+              ImplicitRungeKutta stepper(rhs, a, b, c);
+              if (mode != "coupled")
+                stepper.useButcherTransform(mode == "transformed, threads");
+
+              Vector<> y(n);
+              y = 0.0;
+              int steps = 20;
+              auto start = std::chrono::steady_clock::now();
+              for (int i = 0; i < steps; i++)
+                stepper.DoStep((i % 2) ? 0.01 : 0.011, y);
+              double time = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+              if (mode == "transformed") yref = y;
+              auto & stats = stepper.solver()->totalStats();
+              std::cout << "  " << std::left << std::setw(22) << mode << std::right
+                        << " time/step = " << std::setw(10) << time/steps << " s"
+                        << ", its = " << std::setw(4) << stats.iterations
+                        << ", factorizations = " << std::setw(3) << stats.factorizations
+                        << " (" << std::setw(10) << stats.timeSolve << " s)";
+              if (mode != "coupled")
+                std::cout << ", |y-y0| = " << norm(y-yref);
+              std::cout << std::endl;
+            }
+        }
+    }
+}
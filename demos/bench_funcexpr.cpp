@@ -0,0 +1,105 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+#include <nonlinfunc.hpp>
+#include <funcexpr.hpp>
+#include <timestepper.hpp>
+
+using namespace ASC_ode;
+
+
+// the 2-DOF pendulum of Exercises/PendulumAD_18_5.cpp, final so that
+// FunctionExpr can call it without virtual dispatch
+class Pendulum final : public NonlinearFunction
+{
+  double m_length;
+  double m_gravity;
+public:
+  Pendulum(double length, double gravity=9.81) : m_length(length), m_gravity(gravity) {}
+
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = -m_gravity/m_length*sin(x(0));
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df(0,0) = 0;
+    df(0,1) = 1;
+    df(1,0) = -m_gravity/m_length*cos(x(0));
+    df(1,1) = 0;
+  }
+};
+
+
+template <typename TFUNC>
+double TimeEvaluations (const TFUNC & func, int runs)
+{
+  Vector<> x = { 0.3, 0.1 };
+  Vector<> f(2);
+  Matrix<> df(2, 2);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+    {
+      x(1) = 1e-6*i;
+      func.evaluate(x, f);
+      func.evaluateDeriv(x, df);
+    }
+  auto end = std::chrono::steady_clock::now();
+  if (f(0) == 42) std::cout << "";  // keep the loop alive
+  return std::chrono::duration<double>(end-start).count();
+}
+
+
+double TimeImplicitEuler (std::shared_ptr<NonlinearFunction> equ,
+                          std::shared_ptr<ConstantFunction> yold, int steps)
+{
+  Vector<> y = { M_PI/2, 0 };
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < steps; i++)
+    {
+      yold->set(y);
+      NewtonSolver(equ, y);
+    }
+  auto end = std::chrono::steady_clock::now();
+  std::cout << "  y(tend) = " << y(0) << ", " << y(1) << std::endl;
+  return std::chrono::duration<double>(end-start).count();
+}
+
+
+int main()
+{
+  int runs = 1000000;
+  int steps = 100000;
+  double tau = 1e-4;
+
+  auto rhs = std::make_shared<Pendulum>(1.0);
+  auto yold = std::make_shared<ConstantFunction>(2);
+  auto ptau = std::make_shared<Parameter>(tau);
+
+  // residual of the implicit Euler method, once as shared_ptr tree ...
+  auto ynew = std::make_shared<IdentityFunction>(2);
+  std::shared_ptr<NonlinearFunction> equ_tree = ynew - yold - ptau * rhs;
+
+  // ... and once as expression template
+  auto equ_expr = IdentityExpr(2) - Expr(yold) - ptau * Expr(rhs);
+  auto equ_wrapped = MakeFunction(equ_expr);
+
+  std::cout << runs << " evaluate + evaluateDeriv:" << std::endl;
+  std::cout << "  shared_ptr tree:     " << TimeEvaluations(*equ_tree, runs) << " s" << std::endl;
+  std::cout << "  expression template: " << TimeEvaluations(equ_expr, runs) << " s" << std::endl;
+  std::cout << "  wrapped expression:  " << TimeEvaluations(*equ_wrapped, runs) << " s" << std::endl;
+
+  std::cout << steps << " implicit Euler steps, shared_ptr tree:" << std::endl;
+  double ttree = TimeImplicitEuler(equ_tree, yold, steps);
+  std::cout << "  " << ttree << " s" << std::endl;
+  std::cout << steps << " implicit Euler steps, wrapped expression:" << std::endl;
+  double texpr = TimeImplicitEuler(equ_wrapped, yold, steps);
+  std::cout << "  " << texpr << " s" << std::endl;
+}
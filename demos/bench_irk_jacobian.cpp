@@ -0,0 +1,123 @@
+#define ASC_ODE_COUNT_ALLOCATIONS
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+#include <profiling.hpp>
+
+using namespace ASC_ode;
+
+
+// y' = -K y - y^3  with a dense random K, positive on the diagonal
+class DenseCubic : public NonlinearFunction
+{
+  Matrix<> m_k;
+public:
+  DenseCubic (size_t n)
+    : m_k(n, n)
+  {
+    std::mt19937 gen(2);
+    std::uniform_real_distribution<double> dist(0, 1);
+    for (size_t i = 0; i < n; i++)
+      {
+        for (size_t j = 0; j < n; j++)
+          m_k(i,j) = dist(gen) / n;
+        m_k(i,i) += 1;
+      }
+  }
+
+  size_t dimX() const override { return m_k.rows(); }
+  size_t dimF() const override { return m_k.rows(); }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    size_t n = dimX();
+    for (size_t i = 0; i < n; i++)
+      {
+        double sum = -x(i)*x(i)*x(i);
+        for (size_t j = 0; j < n; j++)
+          sum -= m_k(i,j) * x(j);
+        f(i) = sum;
+      }
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    size_t n = dimX();
+    for (size_t i = 0; i < n; i++)
+      for (size_t j = 0; j < n; j++)
+        df(i,j) = -m_k(i,j);
+    for (size_t i = 0; i < n; i++)
+      df(i,i) -= 3*x(i)*x(i);
+  }
+};
+
+
+// Jacobian of the Radau IIA(5) stage equations, composed from expressions
+//   k - MultipleFunc(f) o (yold + tau (A x I) k)
+// as ImplicitRungeKutta built it before, against IRKResidual with the
+// Kronecker form I - tau (A x J). Time per evaluation, and the
+// bytes allocated by the first one.
+
+int main()
+{
+  int stages = 5;
+  Vector<> c(stages), b1(stages);
+  GaussRadau(c, b1);
+  auto [a, b] = ComputeABfromC(c);
+  double tau = 0.01;
+
+  for (size_t n : { 50, 100, 200, 400 })
+    {
+      auto rhs = std::make_shared<DenseCubic>(n);
+      size_t sn = stages*n;
+      Vector<> y(n), k(sn), ys(sn);
+      for (size_t i = 0; i < n; i++)
+        y(i) = 1.0 / (i+1);
+      for (int j = 0; j < stages; j++)
+        ys.range(j*n, (j+1)*n) = y;
+      k = 0.0;
+
+      auto yold = std::make_shared<ConstantFunction>(ys);
+      auto ptau = std::make_shared<Parameter>(tau);
+      auto knew = std::make_shared<IdentityFunction>(sn);
+      auto composed = Simplify(knew - Compose(std::make_shared<MultipleFunc>(rhs, stages),
+                                              yold+ptau*std::make_shared<MatVecFunc>(a, n)));
+      auto kronecker = std::make_shared<IRKResidual>(rhs, a, c);
+      kronecker->setStep(0, tau, y);
+
+      std::cout << "Radau IIA(5), n = " << n << ", stage system " << sn << std::endl;
+      Matrix<> jac(sn, sn), jacref(sn, sn);
+      for (auto [name, equ] : { std::pair{ "composed", composed },
+                                std::pair{ "kronecker", std::shared_ptr<NonlinearFunction>(kronecker) } })
+        {
+          Matrix<> & df = (std::string(name) == "composed") ? jacref : jac;
+          // the first evaluation allocates the workspaces
+          size_t bytes = AllocatedBytes();
+          equ->evaluateDeriv(k, df);
+          bytes = AllocatedBytes()-bytes;
+
+          int reps = n <= 100 ? 20 : 4;
+          auto start = std::chrono::steady_clock::now();
+          for (int i = 0; i < reps; i++)
+            equ->evaluateDeriv(k, df);
+          double time = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+          std::cout << "  " << std::left << std::setw(10) << name << std::right
+                    << " evaluateDeriv = " << std::setw(10) << time/reps << " s"
+                    << ", workspace = " << std::setw(10) << bytes << " bytes" << std::endl;
+        }
+
+      // at k = 0 all stages are at y, where both are the same matrix
+      double diff = 0;
+      for (size_t i = 0; i < sn; i++)
+        for (size_t j = 0; j < sn; j++)
+          diff = std::max(diff, std::abs(jac(i,j)-jacref(i,j)));
+      std::cout << "  max |difference| = " << diff << std::endl;
+    }
+}
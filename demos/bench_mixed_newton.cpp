@@ -0,0 +1,89 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+
+#include <nonlinfunc.hpp>
+#include <Newton.hpp>
+
+using namespace ASC_ode;
+
+
+// f(x) = A x + x^3 - b  with a dense A = I + s R, R random in [0,1]/n.
+// Large s makes A nearly singular, ill-conditioned beyond float.
+class DenseCoupling : public NonlinearFunction
+{
+  Matrix<> m_a;
+  Vector<> m_b;
+public:
+  DenseCoupling (size_t n, double s)
+    : m_a(n, n), m_b(n)
+  {
+    std::mt19937 gen(1);
+    std::uniform_real_distribution<double> dist(0, 1);
+    for (size_t i = 0; i < n; i++)
+      {
+        for (size_t j = 0; j < n; j++)
+          m_a(i,j) = s * dist(gen) / n;
+        m_a(i,i) += 1;
+        m_b(i) = dist(gen);
+      }
+  }
+
+  size_t dimX() const override { return m_b.size(); }
+  size_t dimF() const override { return m_b.size(); }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    size_t n = dimX();
+    for (size_t i = 0; i < n; i++)
+      {
+        double sum = x(i)*x(i)*x(i) - m_b(i);
+        for (size_t j = 0; j < n; j++)
+          sum += m_a(i,j) * x(j);
+        f(i) = sum;
+      }
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = m_a;
+    for (size_t i = 0; i < dimX(); i++)
+      df(i,i) += 3*x(i)*x(i);
+  }
+};
+
+
+// full Newton with a new Jacobian in every iteration, factorized in double
+// or in float. The float corrections are refined by the Newton iteration
+// itself, with the residuals in double.
+
+int main()
+{
+  for (double s : { 1.0, -0.999999 })
+    for (size_t n : { 250, 500, 1000 })
+      {
+        auto func = std::make_shared<DenseCoupling>(n, s);
+        std::cout << "n = " << n << (s > 0 ? ", well conditioned" : ", nearly singular") << std::endl;
+        for (auto linsolver : { Newton::DENSE, Newton::MIXED })
+          {
+            Newton newton(n, 1e-10, 50);
+            newton.setReuse(false);
+            newton.setLinearSolver(linsolver);
+            Vector<> x(n);
+            x = 0.0;
+
+            auto start = std::chrono::steady_clock::now();
+            newton.solve(func, x);
+            double time = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+            auto & stats = newton.stats();
+            std::cout << "  " << (linsolver == Newton::DENSE ? "double" : "mixed ")
+                      << " time = " << std::setw(10) << time << " s"
+                      << ", factorizations = " << std::setw(10) << stats.timeSolve << " s"
+                      << ", its = " << std::setw(3) << stats.iterations
+                      << ", residual = " << std::setw(12) << stats.residual
+                      << (newton.singlePrecision() ? "" : ", in double") << std::endl;
+          }
+      }
+}
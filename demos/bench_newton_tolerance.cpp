@@ -0,0 +1,97 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+
+using namespace ASC_ode;
+
+
+// stiff Van der Pol oscillator  x'' = mu (1-x^2) x' - x
+class VanDerPol : public NonlinearFunction
+{
+  double m_mu;
+public:
+  VanDerPol (double mu) : m_mu(mu) { }
+
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = m_mu*(1-x(0)*x(0))*x(1) - x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df(0,0) = 0;
+    df(0,1) = 1;
+    df(1,0) = -2*m_mu*x(0)*x(1) - 1;
+    df(1,1) = m_mu*(1-x(0)*x(0));
+  }
+};
+
+
+// work-precision: Newton iterations against the error at the end time,
+// for the absolute residual test and for weighted tolerances.
+// The error of the time discretization hides Newton errors below it,
+// iterating further does not improve the solution.
+
+int main()
+{
+  auto rhs = std::make_shared<VanDerPol>(10);
+  double tend = 2;
+  Vector<> y0 = { 2, 0 };
+
+  int stages = 3;
+  Vector<> c(stages), b1(stages);
+  GaussRadau(c, b1);
+  auto [a, b] = ComputeABfromC(c);
+
+  auto integrate = [&](TimeStepper & stepper, int steps)
+  {
+    Vector<> y = y0;
+    for (int i = 0; i < steps; i++)
+      stepper.DoStep(tend/steps, y);
+    return y;
+  };
+
+  Vector<> yref(2);
+  {
+    ImplicitRungeKutta stepper(rhs, a, b, c);
+    yref = integrate(stepper, 20000);
+  }
+
+  struct Mode { std::string name; double tol; };
+  std::vector<Mode> modes = { { "residual < 1e-10", 0 }, { "rtol = atol = 1e-8", 1e-8 },
+                              { "rtol = atol = 1e-5", 1e-5 }, { "rtol = atol = 1e-3", 1e-3 } };
+
+  for (std::string method : { "Radau IIA(3)", "implicit Euler" })
+    {
+      std::cout << method << std::endl;
+      for (int steps : { 25, 50, 100, 200, 400 })
+        {
+          std::cout << "  steps = " << std::setw(4) << steps << std::endl;
+          for (auto & mode : modes)
+            {
+              std::unique_ptr<TimeStepper> stepper;
+              if (method == "implicit Euler")
+                stepper = std::make_unique<ImplicitEuler>(rhs);
+              else
+                stepper = std::make_unique<ImplicitRungeKutta>(rhs, a, b, c);
+              if (mode.tol > 0)
+                stepper->setTolerances(mode.tol, mode.tol);
+
+              Vector<> y = integrate(*stepper, steps);
+              auto & stats = stepper->solver()->totalStats();
+              std::cout << "    " << std::left << std::setw(22) << mode.name << std::right
+                        << " error = " << std::setw(12) << norm(y-yref)
+                        << ", Newton its/step = " << std::setw(6) << double(stats.iterations)/steps
+                        << ", factorizations = " << stats.factorizations << std::endl;
+            }
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+#include <implicitRK.hpp>
+
+using namespace ASC_ode;
+
+
+// pendulum  x'' = -sin(x), the mass-spring of test_ode with a nonlinear
+// force. For a linear rhs Newton stops after one step from any start.
+class Pendulum : public NonlinearFunction
+{
+public:
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = -std::sin(x(0));
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    df(0,1) = 1;
+    df(1,0) = -std::cos(x(0));
+  }
+};
+
+
+// stiff Van der Pol oscillator  x'' = mu (1-x^2) x' - x
+class VanDerPol : public NonlinearFunction
+{
+  double m_mu;
+public:
+  VanDerPol (double mu) : m_mu(mu) { }
+
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = m_mu*(1-x(0)*x(0))*x(1) - x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df(0,0) = 0;
+    df(0,1) = 1;
+    df(1,0) = -2*m_mu*x(0)*x(1) - 1;
+    df(1,1) = m_mu*(1-x(0)*x(0));
+  }
+};
+
+
+// Newton iterations per step with the stages started at 0 and at the
+// extrapolated collocation polynomial of the last step
+
+int main()
+{
+  struct Problem { std::string name; std::shared_ptr<NonlinearFunction> rhs; Vector<> y0; double tend; };
+  std::vector<Problem> problems = {
+    { "pendulum, amplitude 2", std::make_shared<Pendulum>(), Vector<>{ 2, 0 }, 4*M_PI },
+    { "Van der Pol, mu = 100", std::make_shared<VanDerPol>(100), Vector<>{ 2, 0 }, 10 },
+  };
+
+  for (auto & problem : problems)
+    for (std::string method : { "Gauss(3)", "Radau IIA(3)", "Radau IIA(5)" })
+      {
+        int stages = method == "Radau IIA(5)" ? 5 : 3;
+        Vector<> c(stages), b1(stages);
+        if (method == "Gauss(3)")
+          GaussLegendre(c, b1);
+        else
+          GaussRadau(c, b1);
+        auto [a, b] = ComputeABfromC(c);
+
+        std::cout << problem.name << ", " << method << std::endl;
+        for (int steps : { 100, 1000 })
+          {
+            Vector<> yref(2);
+            for (bool predict : { false, true })
+              {
+                ImplicitRungeKutta stepper(problem.rhs, a, b, c);
+                stepper.setPredictor(predict);
+                Vector<> y = problem.y0;
+                for (int i = 0; i < steps; i++)
+                  stepper.DoStep(problem.tend/steps, y);
+                if (!predict) yref = y;
+
+                auto & stats = stepper.solver()->totalStats();
+                std::cout << "  steps = " << std::setw(5) << steps
+                          << (predict ? ", predicted" : ", k = 0    ")
+                          << "  Newton its/step = " << std::setw(8) << double(stats.iterations)/steps
+                          << ", factorizations = " << std::setw(4) << stats.factorizations
+                          << ", |y-y0| = " << norm(y-yref) << std::endl;
+              }
+          }
+      }
+}
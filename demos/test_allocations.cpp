@@ -0,0 +1,104 @@
+#include <iostream>
+#include <cstdlib>
+#include <new>
+
+#include <nonlinfunc.hpp>
+#include <timestepper.hpp>
+
+using namespace ASC_ode;
+
+
+// count every heap allocation of the program
+static size_t num_allocs = 0;
+
+void * operator new (size_t size)
+{
+  num_allocs++;
+  if (void * p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete (void * p) noexcept { std::free(p); }
+void operator delete (void * p, size_t) noexcept { std::free(p); }
+
+
+class MassSpring : public NonlinearFunction
+{
+private:
+  double mass;
+  double stiffness;
+
+public:
+  MassSpring(double m, double k) : mass(m), stiffness(k) {}
+
+  size_t dimX() const override { return 2; }
+  size_t dimF() const override { return 2; }
+
+  void evaluate (VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = x(1);
+    f(1) = -stiffness/mass*x(0);
+  }
+
+  void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    df(0,1) = 1;
+    df(1,0) = -stiffness/mass;
+  }
+};
+
+
+int main()
+{
+  double tau = 0.1;
+  Vector<> y = { 1, 0 };
+
+  auto rhs = std::make_shared<MassSpring>(1.0, 1.0);
+  auto ynew = std::make_shared<IdentityFunction>(2);
+  auto yold = std::make_shared<ConstantFunction>(y);
+  auto equ = ynew - yold - tau * rhs;
+  auto comp = Compose(rhs, equ);
+
+  Vector<> f(2);
+  Matrix<> df(2, 2);
+
+  // first call reserves the workspace of every node
+  equ->evaluate(y, f);
+  equ->evaluateDeriv(y, df);
+  comp->evaluate(y, f);
+  comp->evaluateDeriv(y, df);
+
+  size_t before = num_allocs;
+  for (int i = 0; i < 100; i++)
+    {
+      equ->evaluate(y, f);
+      equ->evaluateDeriv(y, df);
+      comp->evaluate(y, f);
+      comp->evaluateDeriv(y, df);
+    }
+  size_t funcallocs = num_allocs-before;
+  std::cout << "allocations in 100 evaluate/evaluateDeriv: " << funcallocs << std::endl;
+
+  ImplicitEuler stepper(rhs);
+  stepper.DoStep(tau, y);
+
+  before = num_allocs;
+  int steps = 100;
+  for (int i = 0; i < steps; i++)
+    stepper.DoStep(tau, y);
+  size_t stepallocs = num_allocs-before;
+  std::cout << "allocations in " << steps << " ImplicitEuler::DoStep: " << stepallocs
+            << " (" << double(stepallocs)/steps << " per step)" << std::endl;
+
+  // Newton keeps its vectors and factorization over the steps,
+  // neither the function tree nor a time step may allocate
+  if (funcallocs != 0 || stepallocs != 0)
+    {
+      std::cout << "FAILED" << std::endl;
+      return 1;
+    }
+  std::cout << "OK" << std::endl;
+  return 0;
+}
@@ -4,6 +4,7 @@
 #include <nonlinfunc.hpp>
 #include <timestepper.hpp>
 #include <implicitRK.hpp>
+#include <funcexpr.hpp>
 
 using namespace ASC_ode;
 
@@ -32,6 +33,27 @@ public:
     df(0,1) = 1;
     df(1,0) = -stiffness/mass;
   }
+
+  LINEARITY linearity() const override { return LINEAR; }
+};
+
+
+// forcing cos(t) of  y' = cos(t) - y
+class Forcing : public TimeDependentFunction
+{
+public:
+  size_t dimX() const override { return 1; }
+  size_t dimF() const override { return 1; }
+
+  void evaluate (double t, VectorView<double> x, VectorView<double> f) const override
+  {
+    f(0) = std::cos(t);
+  }
+
+  void evaluateDeriv (double t, VectorView<double> x, MatrixView<double> df) const override
+  {
+    df(0,0) = 0;
+  }
 };
 
 
@@ -97,4 +119,20 @@ int main()
      std::cout << (i+1) * tau << "  " << y(0) << " " << y(1) << std::endl;
      outfile << (i+1) * tau << "  " << y(0) << " " << y(1) << std::endl;
   }
+
+  // a non-autonomous rhs through the expression templates, the stepper
+  // sets the time of the leaf through MakeFunction
+  auto forced = MakeFunction(Expr(std::make_shared<Forcing>()) - IdentityExpr(1));
+  ImplicitRungeKutta forcedStepper(forced, Gauss3a, Gauss3b, Gauss3c);
+  Vector<> yf = { 0 };
+  for (int i = 0; i < steps; i++)
+    forcedStepper.DoStep(tau, yf);
+  double exact = (std::cos(tend) + std::sin(tend) - std::exp(-tend)) / 2;
+  std::cout << "y' = cos(t) - y: y(" << tend << ") = " << yf(0)
+            << ", exact = " << exact << std::endl;
+  if (std::abs(yf(0) - exact) > 1e-8)
+    {
+      std::cout << "FAILED" << std::endl;
+      return 1;
+    }
 }
@@ -2,6 +2,8 @@
 #define NEWMARK_HPP
 
 #include <nonlinfunc.hpp>
+#include <simplify.hpp>
+#include <profiling.hpp>
 
 
 
@@ -10,12 +12,13 @@
   // Newmark and generalized alpha:
   // https://miaodi.github.io/finite%20element%20method/newmark-generalized/
   
-  // Newmark method for  mass*d^2x/dt^2 = rhs
-  void SolveODE_Newmark(double tend, int steps,
+  // Newmark method for  mass*d^2x/dt^2 = rhs, returns the solver statistics
+  NonlinearSolver::Stats SolveODE_Newmark(double tend, int steps,
                         VectorView<double> x, VectorView<double> dx,
                         std::shared_ptr<NonlinearFunction> rhs,   
                         std::shared_ptr<NonlinearFunction> mass,  
-                        std::function<void(double,VectorView<double>)> callback = nullptr)
+                        std::function<void(double,VectorView<double>)> callback = nullptr,
+                        std::shared_ptr<NonlinearSolver> solver = nullptr)
   {
     double dt = tend/steps;
     double gamma = 0.5;
@@ -27,18 +30,23 @@
     auto xold = std::make_shared<ConstantFunction>(x);
     auto vold = std::make_shared<ConstantFunction>(dx);
     auto aold = std::make_shared<ConstantFunction>(x);
-    rhs->evaluate (xold->get(), aold->get());
+    rhs->evaluate (x, a);
+    aold->set(a);
 
     auto anew = std::make_shared<IdentityFunction>(a.size());
     auto vnew = vold + dt*((1-gamma)*aold+gamma*anew);
     auto xnew = xold + dt*vold + dt*dt/2 * ((1-2*beta)*aold+2*beta*anew);    
 
-    auto equ = Compose(mass, anew) - Compose(rhs, xnew);
+    auto equ = Simplify(Compose(mass, anew) - Compose(rhs, xnew));
+    equ = Profiler::global().instrument(equ, "SolveODE_Newmark");
+    // dt is fixed, the factorized Jacobian is kept over the steps
+    if (!solver)
+      solver = std::make_shared<Newton>(a.size());
 
     double t = 0;
     for (int i = 0; i < steps; i++)            
       {
-        NewtonSolver (equ, a);
+        solver->solve (equ, a);
         xnew -> evaluate (a, x);
         vnew -> evaluate (a, v);
 
@@ -49,17 +57,19 @@
         if (callback) callback(t, x);
       }
     dx = v;
+    return solver->totalStats();
   }
 
 
 
 
-  // Generalized alpha method for M d^2x/dt^2 = rhs
-  void SolveODE_Alpha (double tend, int steps, double rhoinf,
+  // Generalized alpha method for M d^2x/dt^2 = rhs, returns the solver statistics
+  NonlinearSolver::Stats SolveODE_Alpha (double tend, int steps, double rhoinf,
                        VectorView<double> x, VectorView<double> dx, VectorView<double> ddx,
                        std::shared_ptr<NonlinearFunction> rhs,   
                        std::shared_ptr<NonlinearFunction> mass,  
-                       std::function<void(double,VectorView<double>)> callback = nullptr)
+                       std::function<void(double,VectorView<double>)> callback = nullptr,
+                       std::shared_ptr<NonlinearSolver> solver = nullptr)
   {
     double dt = tend/steps;
     double alpham = (2*rhoinf-1)/(rhoinf+1);
@@ -73,21 +83,25 @@
     auto xold = std::make_shared<ConstantFunction>(x);
     auto vold = std::make_shared<ConstantFunction>(dx);
     auto aold = std::make_shared<ConstantFunction>(ddx);
-    // rhs->evaluate (xold->get(), aold->get()); // solve with M ???
+    // rhs->evaluate (x, a); aold->set(a); // solve with M ???
 
     auto anew = std::make_shared<IdentityFunction>(a.size());
     auto vnew = vold + dt*((1-gamma)*aold+gamma*anew);
     auto xnew = xold + dt*vold + dt*dt/2 * ((1-2*beta)*aold+2*beta*anew);    
 
     // auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - Compose(rhs, (1-alphaf)*xnew+alphaf*xold);
-    auto equ = Compose(mass, (1-alpham)*anew+alpham*aold) - (1-alphaf)*Compose(rhs,xnew) - alphaf*Compose(rhs, xold);
+    auto equ = Simplify(Compose(mass, (1-alpham)*anew+alpham*aold) - (1-alphaf)*Compose(rhs,xnew) - alphaf*Compose(rhs, xold));
+    equ = Profiler::global().instrument(equ, "SolveODE_Alpha");
+    // dt is fixed, the factorized Jacobian is kept over the steps
+    if (!solver)
+      solver = std::make_shared<Newton>(a.size());
 
     double t = 0;
     a = ddx;
 
     for (int i = 0; i < steps; i++)
       {
-        NewtonSolver (equ, a);
+        solver->solve (equ, a);
         xnew -> evaluate (a, x);
         vnew -> evaluate (a, v);
 
@@ -99,6 +113,7 @@
       }
     dx = v;
     ddx = a;
+    return solver->totalStats();
   }
 
 
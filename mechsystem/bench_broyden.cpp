@@ -0,0 +1,59 @@
+#include <chrono>
+
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+#include <broyden.hpp>
+
+// generalized alpha for a chain falling from the horizontal, with large
+// rotations the Jacobian changes from step to step. Full Newton assembles
+// it in every iteration, simplified Newton when the contraction gets slow,
+// Broyden corrects the kept factorization by secant updates instead.
+
+int main()
+{
+  for (size_t n : { 20, 100, 400 })
+    {
+      MassSpringSystem<2> mss;
+      mss.setGravity( {0,-9.81} );
+      Connector prev = mss.addFix( { { 0.0, 0.0 } } );
+      for (size_t i = 0; i < n; i++)
+        {
+          auto m = mss.addMass( { 1, { double(i+1), 0.0 } } );
+          mss.addSpring ( { 1, 1000, { prev, m } } );
+          prev = m;
+        }
+      auto mss_func = std::make_shared<MSS_Function<2>> (mss);
+      auto mass = std::make_shared<IdentityFunction> (2*n);
+      double tol = 1e-8;
+
+      auto full = std::make_shared<Newton>(2*n, tol);
+      full->setReuse(false);
+      std::vector<std::pair<std::string, std::shared_ptr<NonlinearSolver>>> solvers =
+        {
+          { "Newton", full },
+          { "simplified Newton", std::make_shared<Newton>(2*n, tol) },
+          { "Broyden", std::make_shared<Broyden>(2*n, tol) },
+        };
+
+      std::cout << "masses = " << n << ", unknowns = " << 2*n << std::endl;
+      Vector<> xref(2*n);
+      for (size_t k = 0; k < solvers.size(); k++)
+        {
+          auto & [name, solver] = solvers[k];
+          Vector<> x(2*n), dx(2*n), ddx(2*n);
+          mss.getState (x, dx, ddx);
+
+          auto start = std::chrono::steady_clock::now();
+          auto stats = SolveODE_Alpha (2, 50, 0.8, x, dx, ddx, mss_func, mass, nullptr, solver);
+          double time = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+          if (k == 0) xref = x;
+          std::cout << "  " << std::left << std::setw(18) << name << std::right
+                    << " time = " << std::setw(10) << time << " s"
+                    << ", its = " << std::setw(5) << stats.iterations
+                    << ", Jacobians = " << std::setw(5) << stats.factorizations
+                    << " (" << std::setw(10) << stats.timeDeriv + stats.timeSolve << " s)"
+                    << ", |x-x0| = " << norm(x-xref) << std::endl;
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#include <chrono>
+
+#include "mass_spring.hpp"
+
+// hand-coded Jacobian of MSS_Function against the AutoDiff Jacobian of
+// MSS_FunctionAD and colored central differences for chains of growing
+// length. Both need a number of evaluations given by the colors of the
+// sparsity pattern, not by the number of unknowns.
+
+template <typename TFUNC>
+double TimeJacobian (const TFUNC & func, VectorView<double> x, MatrixView<double> df, int runs)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+    func.evaluateDeriv(x, df);
+  auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end-start).count() / runs;
+}
+
+int main()
+{
+  for (size_t n : { 5, 20, 100, 400 })
+    {
+      MassSpringSystem<2> mss;
+      mss.setGravity( {0,-9.81} );
+      Connector prev = mss.addFix( { { 0.0, 0.0 } } );
+      for (size_t i = 0; i < n; i++)
+        {
+          auto m = mss.addMass( { 1, { double(i+1), 0.1*i } } );
+          mss.addSpring ( { 1, 10, { prev, m } } );
+          prev = m;
+        }
+
+      Vector<> x(2*n), dx(2*n), ddx(2*n);
+      mss.getState (x, dx, ddx);
+
+      MSS_Function<2> hand(mss);
+      MSS_FunctionAD<2> ad(mss);
+      Matrix<> dfhand(2*n, 2*n), dfad(2*n, 2*n);
+
+      int runs = std::max<int>(1, 200000 / (n*n));
+      double thand = TimeJacobian(hand, x, dfhand, runs);
+      double tad = TimeJacobian(ad, x, dfad, runs);
+
+      ColoredJacobian colored(hand);
+      Matrix<> dffd(2*n, 2*n);
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < runs; i++)
+        colored.evaluateFD(hand, x, dffd);
+      auto end = std::chrono::steady_clock::now();
+      double tfd = std::chrono::duration<double>(end-start).count() / runs;
+
+      double errad = 0, errfd = 0;
+      for (size_t i = 0; i < 2*n; i++)
+        for (size_t j = 0; j < 2*n; j++)
+          {
+            errad = std::max(errad, std::abs(dfhand(i,j)-dfad(i,j)));
+            errfd = std::max(errfd, std::abs(dfhand(i,j)-dffd(i,j)));
+          }
+
+      std::cout << "masses = " << n << ", colors = " << colored.numColors()
+                << " (AutoDiff: " << ad.numColors() << ")" << std::endl
+                << "  hand-coded:     " << thand << " s" << std::endl
+                << "  AutoDiff<8>:    " << tad << " s, max difference = " << errad << std::endl
+                << "  colored FD:     " << tfd << " s, max difference = " << errfd << std::endl;
+    }
+}
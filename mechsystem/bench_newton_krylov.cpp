@@ -0,0 +1,67 @@
+#include <chrono>
+
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+#include <krylov.hpp>
+
+// generalized alpha for hanging chains of growing length, with the dense
+// simplified Newton against Jacobian-free Newton-Krylov and its
+// preconditioners. Newton needs O(n^2) memory and O(n^3) per factorization,
+// Newton-Krylov only products with the Jacobian. The spring forces are
+// of order 1e4, the tolerance of the residual is chosen accordingly.
+
+int main()
+{
+  for (size_t n : { 100, 500, 2000 })
+    {
+      MassSpringSystem<2> mss;
+      mss.setGravity( {0,-9.81} );
+      Connector prev = mss.addFix( { { 0.0, 0.0 } } );
+      for (size_t i = 0; i < n; i++)
+        {
+          auto m = mss.addMass( { 1, { 0.0, -double(i+1) } } );
+          mss.addSpring ( { 1, 1000, { prev, m } } );
+          prev = m;
+        }
+      auto mss_func = std::make_shared<MSS_Function<2>> (mss);
+      auto mass = std::make_shared<IdentityFunction> (2*n);
+      double tol = 1e-6;
+
+      std::vector<std::pair<std::string, std::shared_ptr<NonlinearSolver>>> solvers =
+        {
+          { "Newton-Krylov",                std::make_shared<NewtonKrylov>(nullptr, tol) },
+          { "Newton-Krylov, Jacobi",        std::make_shared<NewtonKrylov>(std::make_shared<JacobiPreconditioner>(), tol) },
+          { "Newton-Krylov, block-Jacobi",  std::make_shared<NewtonKrylov>(std::make_shared<BlockJacobiPreconditioner>(2), tol) },
+          { "Newton-Krylov, probed b-J",    std::make_shared<NewtonKrylov>(std::make_shared<BlockJacobiPreconditioner>
+                                                                           (2, SparsePreconditioner::PROBE), tol) },
+          { "Newton-Krylov, ILU(0)",        std::make_shared<NewtonKrylov>(std::make_shared<ILU0Preconditioner>(), tol) },
+        };
+      if (n <= 500)
+        {
+          auto newton = std::make_shared<Newton>(2*n, tol);
+          newton->setLinearSolver(Newton::DENSE);
+          solvers.insert(solvers.begin(), { "Newton, dense LU", newton });
+        }
+
+      std::cout << "masses = " << n << ", unknowns = " << 2*n << std::endl;
+      Vector<> xref(2*n);
+      for (size_t k = 0; k < solvers.size(); k++)
+        {
+          auto & [name, solver] = solvers[k];
+          Vector<> x(2*n), dx(2*n), ddx(2*n);
+          mss.getState (x, dx, ddx);
+
+          auto start = std::chrono::steady_clock::now();
+          auto stats = SolveODE_Alpha (0.1, 20, 0.8, x, dx, ddx, mss_func, mass, nullptr, solver);
+          double time = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+          if (k == 0) xref = x;
+          std::cout << "  " << std::left << std::setw(30) << name << std::right
+                    << " time = " << std::setw(10) << time << " s"
+                    << ", Newton its = " << std::setw(4) << stats.iterations
+                    << ", GMRES its = " << std::setw(6) << stats.linearIterations
+                    << ", setups = " << std::setw(3) << stats.factorizations
+                    << ", |x-x0| = " << norm(x-xref) << std::endl;
+        }
+    }
+}
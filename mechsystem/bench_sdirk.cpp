@@ -0,0 +1,153 @@
+#include <chrono>
+
+#include "mass_spring.hpp"
+#include <implicitRK.hpp>
+#include <sdirk.hpp>
+
+// The built-in tableaus first: the orders observed on y' = -y, from the
+// error at t = 1 and from the error estimate of one step, when tau is halved.
+// Then hanging chains with stiff springs as first order system y = (x, v).
+// Radau IIA(5) solves the coupled 3n x 3n stage system, the SDIRK methods
+// s sequential systems of size n with one factorization for all stages
+// and steps. Newton stops at the weighted tolerances, the residual of the
+// stiff springs does not reach an absolute one. Fixed steps against a
+// reference with small steps, then ESDIRK3 with step size control by the
+// embedded error estimate.
+
+int main()
+{
+  bool failed = false;
+  auto decay = -1.0 * std::make_shared<IdentityFunction>(1);
+  for (auto [name, method] : { std::pair{ "TR-BDF2", SDIRK::TRBDF2 },
+                               std::pair{ "ESDIRK3", SDIRK::ESDIRK3 },
+                               std::pair{ "SDIRK4", SDIRK::SDIRK4 } })
+    {
+      auto tab = SDIRK::builtin(method);
+      double err[3], est[3];
+      for (int l = 0; l < 3; l++)
+        {
+          int steps = 10 << l;
+          SDIRK stepper(decay, tab);
+          Vector<> y{ 1 };
+          for (int i = 0; i < steps; i++)
+            {
+              stepper.DoStep(1.0/steps, y);
+              if (i == 0) est[l] = std::abs(stepper.errorEstimate()(0));
+            }
+          err[l] = std::abs(y(0) - std::exp(-1.0));
+        }
+      double order = std::log2(err[1]/err[2]);
+      double local = std::log2(est[1]/est[2]);
+      int estorder = std::min(tab.order, tab.embeddedOrder) + 1;
+      bool ok = order > tab.order - 0.2 && local > estorder - 0.2;
+      failed = failed || !ok;
+      std::cout << std::left << std::setw(8) << name << std::right
+                << " order = " << std::setprecision(3) << order << " (" << tab.order << ")"
+                << ", error estimate ~ tau^" << local << " (" << estorder << ")"
+                << (ok ? "" : "  FAILED") << std::setprecision(6) << std::endl;
+    }
+  if (failed) return 1;
+
+  for (size_t masses : { 100, 1000 })
+    {
+      MassSpringSystem<2> mss;
+      mss.setGravity( {0,-9.81} );
+      Connector prev = mss.addFix( { { 0.0, 0.0 } } );
+      for (size_t i = 0; i < masses; i++)
+        {
+          auto m = mss.addMass( { 1, { 0.0, -double(i+1) } } );
+          mss.addSpring ( { 1, 1e5, { prev, m } } );
+          prev = m;
+        }
+      size_t n = 2*masses;
+      auto forces = std::make_shared<MSS_Function<2>> (mss);
+      auto ode = std::make_shared<EmbedFunction>(std::make_shared<IdentityFunction>(n), n, 2*n, 0, 2*n)
+        + std::make_shared<EmbedFunction>(forces, 0, 2*n, n, 2*n);
+
+      Vector<> x(n), dx(n), ddx(n), y0(2*n);
+      mss.getState (x, dx, ddx);
+      y0.range(0, n) = x;
+      y0.range(n, 2*n) = dx;
+      double tend = 0.1;
+
+      Vector<> yref(2*n);
+      {
+        yref = y0;
+        SDIRK stepper(ode, SDIRK::SDIRK4);
+        stepper.setTolerances(1e-10, 1e-10);
+        for (int i = 0; i < 1000; i++)
+          stepper.DoStep(tend/1000, yref);
+      }
+
+      std::cout << "masses = " << masses << ", unknowns = " << 2*n << std::endl;
+      auto report = [&] (std::string name, TimeStepper & stepper, int steps,
+                         std::chrono::steady_clock::time_point start, VectorView<double> y)
+      {
+        double time = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+        auto & stats = stepper.solver()->totalStats();
+        std::cout << "  " << std::left << std::setw(18) << name << std::right
+                  << " steps = " << std::setw(4) << steps
+                  << ", time/step = " << std::setw(10) << time/steps << " s"
+                  << ", its = " << std::setw(5) << stats.iterations
+                  << ", factorizations = " << std::setw(3) << stats.factorizations
+                  << ", |y-yref| = " << norm(y-yref) << std::endl;
+      };
+
+      int steps = 50;
+      {
+        int stages = 3;
+        Vector<> c(stages), b1(stages);
+        GaussRadau(c, b1);
+        auto [a, b] = ComputeABfromC(c);
+        ImplicitRungeKutta stepper(ode, a, b, c);
+        stepper.setTolerances(1e-8, 1e-8);
+        Vector<> y = y0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < steps; i++)
+          stepper.DoStep(tend/steps, y);
+        report("Radau IIA(5)", stepper, steps, start, y);
+      }
+
+      for (auto [name, method] : { std::pair{ "TR-BDF2", SDIRK::TRBDF2 },
+                                   std::pair{ "ESDIRK3", SDIRK::ESDIRK3 },
+                                   std::pair{ "SDIRK4", SDIRK::SDIRK4 } })
+        {
+          SDIRK stepper(ode, method);
+          stepper.setTolerances(1e-8, 1e-8);
+          Vector<> y = y0;
+          auto start = std::chrono::steady_clock::now();
+          for (int i = 0; i < steps; i++)
+            stepper.DoStep(tend/steps, y);
+          report(name, stepper, steps, start, y);
+        }
+
+      // a rejected step restarts from ysave with the proposed smaller step
+      {
+        SDIRK stepper(ode, SDIRK::ESDIRK3);
+        stepper.setTolerances(1e-8, 1e-8);
+        Vector<> y = y0, ysave(2*n);
+        double t = 0, tau = 1e-4;
+        int accepted = 0, rejected = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (t < tend)
+          {
+            tau = std::min(tau, tend-t);
+            ysave = y;
+            stepper.DoStep(t, tau, y);
+            if (stepper.error() <= 1)
+              {
+                t += tau;
+                accepted++;
+              }
+            else
+              {
+                y = ysave;
+                rejected++;
+              }
+            tau = stepper.proposeStep(tau);
+          }
+        report("ESDIRK3, tol 1e-8", stepper, accepted, start, y);
+        std::cout << "  " << std::setw(18) << "" << " rejected = " << rejected << std::endl;
+      }
+    }
+}
@@ -0,0 +1,63 @@
+#include <chrono>
+
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+
+// time per Newton iteration of generalized alpha for hanging chains of
+// 10 to 100k masses, full Newton with a new Jacobian in every iteration.
+// The dense LU grows with n^3, the sparse solvers linearly: the banded
+// fast path in the numbering of the chain, the general solver in a
+// minimum degree ordering.
+
+int main()
+{
+  for (size_t n : { 10, 100, 1000, 10000, 100000 })
+    {
+      MassSpringSystem<2> mss;
+      mss.setGravity( {0,-9.81} );
+      Connector prev = mss.addFix( { { 0.0, 0.0 } } );
+      for (size_t i = 0; i < n; i++)
+        {
+          auto m = mss.addMass( { 1, { 0.0, -double(i+1) } } );
+          mss.addSpring ( { 1, 1000, { prev, m } } );
+          prev = m;
+        }
+      auto mss_func = std::make_shared<MSS_Function<2>> (mss);
+      auto mass = std::make_shared<IdentityFunction> (2*n);
+
+      std::vector<std::pair<std::string, Newton::LINEARSOLVER>> solvers =
+        {
+          { "sparse, general", Newton::SPARSE },
+          { "sparse, banded", Newton::BANDED },
+          { "automatic", Newton::AUTO },
+        };
+      if (n <= 500)
+        solvers.insert(solvers.begin(), { "dense LU", Newton::DENSE });
+
+      std::cout << "masses = " << n << ", unknowns = " << 2*n << std::endl;
+      Vector<> xref(2*n);
+      for (size_t k = 0; k < solvers.size(); k++)
+        {
+          auto & [name, linsolver] = solvers[k];
+          auto solver = std::make_shared<Newton>(2*n, 1e-6);
+          solver->setReuse(false);
+          solver->setLinearSolver(linsolver);
+
+          Vector<> x(2*n), dx(2*n), ddx(2*n);
+          mss.getState (x, dx, ddx);
+          auto stats = SolveODE_Alpha (0.1, 5, 0.8, x, dx, ddx, mss_func, mass, nullptr, solver);
+
+          if (k == 0) xref = x;
+          double time = stats.timeEvaluate + stats.timeDeriv + stats.timeSolve;
+          std::cout << "  " << std::left << std::setw(18) << name << std::right
+                    << " its = " << std::setw(4) << stats.iterations
+                    << ", time/it = " << std::setw(10) << time/stats.iterations << " s"
+                    << " (Jacobian " << std::setw(10) << stats.timeDeriv/stats.iterations
+                    << ", LU " << std::setw(10) << stats.timeSolve/stats.iterations << ")";
+          if (auto slu = solver->sparseLU())
+            std::cout << ", " << (slu->method() == SparseLU::BANDED ? "banded" : "general")
+                      << ", entries of LU = " << slu->nzeFactor();
+          std::cout << ", |x-x0| = " << norm(x-xref) << std::endl;
+        }
+    }
+}
@@ -67,6 +67,27 @@ PYBIND11_MODULE(mass_spring, m) {
       return Fix<3>{ { p[0], p[1], p[2] } };
     });
 
+    py::class_<NonlinearSolver::Stats> (m, "NewtonStats")
+      .def_readonly("solves", &NonlinearSolver::Stats::solves)
+      .def_readonly("iterations", &NonlinearSolver::Stats::iterations)
+      .def_readonly("factorizations", &NonlinearSolver::Stats::factorizations)
+      .def_readonly("linear_iterations", &NonlinearSolver::Stats::linearIterations)
+      .def_readonly("rate", &NonlinearSolver::Stats::rate)
+      .def_readonly("residual", &NonlinearSolver::Stats::residual)
+      .def_readonly("time_evaluate", &NonlinearSolver::Stats::timeEvaluate)
+      .def_readonly("time_deriv", &NonlinearSolver::Stats::timeDeriv)
+      .def_readonly("time_solve", &NonlinearSolver::Stats::timeSolve)
+      .def("__str__", [](NonlinearSolver::Stats & s) {
+        std::stringstream sstr;
+        sstr << "solves = " << s.solves << ", iterations = " << s.iterations
+             << ", factorizations = " << s.factorizations
+             << ", linear iterations = " << s.linearIterations << ", max rate = " << s.rate
+             << ", residual = " << s.residual << ", time evaluate/deriv/solve = "
+             << s.timeEvaluate << "/" << s.timeDeriv << "/" << s.timeSolve << " s";
+        return sstr.str();
+      })
+      ;
+
     py::class_<Connector> (m, "Connector");
 
     py::class_<Spring> (m, "Spring")
@@ -124,9 +145,10 @@ PYBIND11_MODULE(mass_spring, m) {
         auto mss_func = std::make_shared<MSS_Function<3>> (mss);
         auto mass = std::make_shared<IdentityFunction> (x.size());
 
-        SolveODE_Alpha(tend, steps, 0.8, x, dx, ddx, mss_func, mass);
+        auto stats = SolveODE_Alpha(tend, steps, 0.8, x, dx, ddx, mss_func, mass);
 
         mss.setState (x, dx, ddx);  
+        return stats;
     });
 
 
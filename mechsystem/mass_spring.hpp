@@ -3,6 +3,7 @@
 
 #include "nonlinfunc.hpp"
 #include "timestepper.hpp"
+#include "autodifffunc.hpp"
 
 using namespace ASC_ode;
 
@@ -136,6 +137,68 @@ template <int D>
 class MSS_Function : public NonlinearFunction
 {
   MassSpringSystem<D> & mss;
+  Workspace m_ws;
+
+  // length s and direction u = (p2-p1)/s of a spring at the positions x,
+  // and the Jacobian of its force F = k (s-L) u on c1,
+  //   dF/dp2 = -dF/dp1 = K = k (u u^T + (s-L)/s (I - u u^T)).
+  // K is not set for s = 0.
+  double springStiffness (const Spring & spring, VectorView<double> x,
+                          Vec<D> & u, double (&K)[D][D]) const
+  {
+    auto xmat = x.asMatrix(mss.masses().size(), D);
+    auto [c1,c2] = spring.connectors;
+    Vec<D> p1, p2;
+    if (c1.type == Connector::FIX)
+      p1 = mss.fixes()[c1.nr].pos;
+    else
+      p1 = xmat.row(c1.nr);
+    if (c2.type == Connector::FIX)
+      p2 = mss.fixes()[c2.nr].pos;
+    else
+      p2 = xmat.row(c2.nr);
+
+    Vec<D> d = p2-p1;
+    double s = norm(d);
+    if (s < 1e-12) return s;
+    u = 1.0/s * d;
+
+    double coeff = (s-spring.length) / s;
+    for (int r = 0; r < D; r++)
+      for (int c = 0; c < D; c++)
+        K[r][c] = spring.stiffness * ((1-coeff)*u(r)*u(c) + (r == c ? coeff : 0.0));
+    return s;
+  }
+
+  // the blocks of K in the Jacobian M^{-1} S, dense or sparse:
+  // -K/m for the mass itself, +K/m for the mass at the other end
+  template <typename TM>
+  void addStiffness (TM & df, const Spring & spring, const double (&K)[D][D]) const
+  {
+    auto addBlock = [&](size_t i, size_t j, double fac)
+    {
+      for (int r = 0; r < D; r++)
+        for (int c = 0; c < D; c++)
+          df(i*D+r, j*D+c) += fac * K[r][c];
+    };
+
+    auto [c1,c2] = spring.connectors;
+    if (c1.type == Connector::MASS)
+      {
+        double m1 = mss.masses()[c1.nr].mass;
+        addBlock(c1.nr, c1.nr, -1/m1);
+        if (c2.type == Connector::MASS)
+          addBlock(c1.nr, c2.nr, 1/m1);
+      }
+    if (c2.type == Connector::MASS)
+      {
+        double m2 = mss.masses()[c2.nr].mass;
+        addBlock(c2.nr, c2.nr, -1/m2);
+        if (c1.type == Connector::MASS)
+          addBlock(c2.nr, c1.nr, 1/m2);
+      }
+  }
+
 public:
   MSS_Function (MassSpringSystem<D> & _mss)
     : mss(_mss) { }
@@ -178,6 +241,159 @@ public:
       fmat.row(i) *= 1.0/mss.masses()[i].mass;
   }
 
+  // one state per column: the loops over the batch are innermost and vectorize
+  virtual void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+  {
+    size_t nb = x.cols();
+    auto diff = m_ws.mat(0, D, nb);
+    auto fac = m_ws.vec(1, nb);
+
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      for (int r = 0; r < D; r++)
+        f.row(i*D+r) = mss.masses()[i].mass*mss.getGravity()(r);
+
+    for (auto & spring : mss.springs())
+      {
+        auto [c1,c2] = spring.connectors;
+
+        // diff = p2-p1
+        for (int r = 0; r < D; r++)
+          {
+            if (c2.type == Connector::FIX)
+              diff.row(r) = mss.fixes()[c2.nr].pos(r);
+            else
+              diff.row(r) = x.row(c2.nr*D+r);
+            if (c1.type == Connector::FIX)
+              {
+                double p1 = mss.fixes()[c1.nr].pos(r);
+                for (size_t j = 0; j < nb; j++)
+                  diff(r,j) -= p1;
+              }
+            else
+              for (size_t j = 0; j < nb; j++)
+                diff(r,j) -= x(c1.nr*D+r, j);
+          }
+
+        // force/length = k (|p2-p1|-L) / |p2-p1|
+        for (size_t j = 0; j < nb; j++)
+          {
+            double len2 = 0;
+            for (int r = 0; r < D; r++)
+              len2 += diff(r,j)*diff(r,j);
+            double len = std::sqrt(len2);
+            fac(j) = spring.stiffness * (len-spring.length) / len;
+          }
+
+        for (int r = 0; r < D; r++)
+          for (size_t j = 0; j < nb; j++)
+            {
+              double force = fac(j)*diff(r,j);
+              if (c1.type == Connector::MASS)
+                f(c1.nr*D+r, j) += force;
+              if (c2.type == Connector::MASS)
+                f(c2.nr*D+r, j) -= force;
+            }
+      }
+
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      f.rows(i*D, (i+1)*D) *= 1.0/mss.masses()[i].mass;
+  }
+
+  // D x D blocks coupling the masses at the ends of every spring
+  virtual SparsityPattern pattern() const override
+  {
+    SparsityPattern pattern(dimF());
+    auto addBlock = [&](size_t i, size_t j)
+    {
+      for (int r = 0; r < D; r++)
+        for (int c = 0; c < D; c++)
+          pattern[i*D+r].push_back(j*D+c);
+    };
+    for (auto & spring : mss.springs())
+      {
+        auto [c1,c2] = spring.connectors;
+        if (c1.type == Connector::MASS)
+          addBlock(c1.nr, c1.nr);
+        if (c2.type == Connector::MASS)
+          addBlock(c2.nr, c2.nr);
+        if (c1.type == Connector::MASS && c2.type == Connector::MASS)
+          {
+            addBlock(c1.nr, c2.nr);
+            addBlock(c2.nr, c1.nr);
+          }
+      }
+    for (auto & row : pattern)
+      {
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
+      }
+    return pattern;
+  }
+
+  // The Jacobian is M^{-1} S with the symmetric stiffness matrix S,
+  // so  J v = M^{-1} (S v)  and  J^T w = S (M^{-1} w).
+  virtual void applyDeriv (VectorView<double> x, VectorView<double> v,
+                           VectorView<double> Jv) const override
+  {
+    applyStiffness(x, v, Jv);
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      Jv.range(i*D, (i+1)*D) *= 1.0/mss.masses()[i].mass;
+  }
+
+  virtual void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                                    VectorView<double> JTw) const override
+  {
+    auto mw = m_ws.vec(2, dimX());
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      mw.range(i*D, (i+1)*D) = 1.0/mss.masses()[i].mass * w.range(i*D, (i+1)*D);
+    applyStiffness(x, mw, JTw);
+  }
+
+  // Sv = S v, fixed points do not move
+  void applyStiffness (VectorView<double> x, VectorView<double> v, VectorView<double> Sv) const
+  {
+    Sv = 0.0;
+    auto vmat = v.asMatrix(mss.masses().size(), D);
+    auto svmat = Sv.asMatrix(mss.masses().size(), D);
+
+    for (auto & spring : mss.springs())
+      {
+        Vec<D> u;
+        double K[D][D];
+        if (springStiffness(spring, x, u, K) < 1e-12) continue;
+
+        auto [c1,c2] = spring.connectors;
+        Vec<D> dv = 0.0;
+        if (c1.type == Connector::MASS)
+          dv -= vmat.row(c1.nr);
+        if (c2.type == Connector::MASS)
+          dv += vmat.row(c2.nr);
+
+        Vec<D> kdv = 0.0;
+        for (int r = 0; r < D; r++)
+          for (int c = 0; c < D; c++)
+            kdv(r) += K[r][c] * dv(c);
+
+        if (c1.type == Connector::MASS)
+          svmat.row(c1.nr) += kdv;
+        if (c2.type == Connector::MASS)
+          svmat.row(c2.nr) -= kdv;
+      }
+  }
+
+  // the blocks of pattern(), without the dense matrix of the default
+  virtual void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+  {
+    df = 0.0;
+    for (auto & spring : mss.springs())
+      {
+        Vec<D> u;
+        double K[D][D];
+        if (springStiffness(spring, x, u, K) >= 1e-12)
+          addStiffness(df, spring, K);
+      }
+  }
+
 /*
   virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override   // Finite difference need to Modify !!!!!
   {
@@ -196,125 +412,105 @@ public:
       }
   }                               // Modify till here !!!!!
 */ 
-    virtual void evaluateDeriv(VectorView<double> x, MatrixView<double> df) const override
-    {
-        df = 0.0;
-
-        auto xmat = x.asMatrix(mss.masses().size(), D);
-
-        // writeBlock 的矩陣型別：nanoblas::Matrix<double>
-        auto writeBlock = [&](size_t i, size_t j, const nanoblas::Matrix<double>& M)
-        {
-            for (int r = 0; r < D; r++)
-                for (int c = 0; c < D; c++)
-                    df(i * D + r, j * D + c) += M(r, c);
-        };
-
-        for (auto &spring : mss.springs())
-        {
-            auto [c1, c2] = spring.connectors;
-
-            // --- positions ---
-            Vec<D> p1, p2;
-            if (c1.type == Connector::FIX)
-                p1 = mss.fixes()[c1.nr].pos;
-            else
-                p1 = xmat.row(c1.nr);
-
-            if (c2.type == Connector::FIX)
-                p2 = mss.fixes()[c2.nr].pos;
-            else
-                p2 = xmat.row(c2.nr);
+  virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+  {
+    df = 0.0;
+    for (auto & spring : mss.springs())
+      {
+        Vec<D> u;
+        double K[D][D];
+        if (springStiffness(spring, x, u, K) >= 1e-12)
+          addStiffness(df, spring, K);
+      }
+  }
 
-            Vec<D> d = p2 - p1;
-            double s = norm(d);
-            if (s < 1e-12) continue;
+  // forces and Jacobian in one pass over the springs
+  virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                                  MatrixView<double> df) const override
+  {
+    f = 0.0;
+    df = 0.0;
 
-            Vec<D> u = (1.0 / s) * d;
+    auto fmat = f.asMatrix(mss.masses().size(), D);
 
-            double k = spring.stiffness;
-            double L = spring.length;
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      fmat.row(i) = mss.masses()[i].mass*mss.getGravity();
 
-            // --- Build matrices ---
-            nanoblas::Matrix<double> A(D, D);      // uu^T
-            nanoblas::Matrix<double> I(D, D);      // identity
-            nanoblas::Matrix<double> B(D, D);      // I - A
+    for (auto & spring : mss.springs())
+      {
+        Vec<D> u;
+        double K[D][D];
+        double s = springStiffness(spring, x, u, K);
+        if (s < 1e-12) continue;
 
-            A = 0.0;
-            I = 0.0;
+        auto [c1,c2] = spring.connectors;
+        double force = spring.stiffness * (s-spring.length);
+        if (c1.type == Connector::MASS)
+          fmat.row(c1.nr) += force*u;
+        if (c2.type == Connector::MASS)
+          fmat.row(c2.nr) -= force*u;
 
-            for (int r = 0; r < D; r++)
-                for (int c = 0; c < D; c++)
-                    A(r, c) = u(r) * u(c);
+        addStiffness(df, spring, K);
+      }
 
-            for (int r = 0; r < D; r++)
-                I(r, r) = 1.0;
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      fmat.row(i) *= 1.0/mss.masses()[i].mass;
+  }
 
-            // B = I - A
-            for (int r = 0; r < D; r++)
-                for (int c = 0; c < D; c++)
-                    B(r, c) = I(r, c) - A(r, c);
+};
 
-            double coeff = (s - L) / s;
+// the forces of MSS_Function written once for double and AutoDiff,
+// the Jacobian comes from forward mode AutoDiff
+template <int D, size_t N = 8>
+class MSS_FunctionAD : public AutoDiffFunction<MSS_FunctionAD<D,N>, N>
+{
+  MassSpringSystem<D> & mss;
+public:
+  MSS_FunctionAD (MassSpringSystem<D> & _mss)
+    : mss(_mss) { }
 
-            // --- dF/dp1 and dF/dp2 ---
-            nanoblas::Matrix<double> dF_dp1(D, D);
-            nanoblas::Matrix<double> dF_dp2(D, D);
+  virtual size_t dimX() const override { return D*mss.masses().size(); }
+  virtual size_t dimF() const override { return D*mss.masses().size(); }
 
-            for (int r = 0; r < D; r++)
-                for (int c = 0; c < D; c++) {
-                    double Mval = A(r, c) + coeff * B(r, c);
-                    dF_dp1(r, c) = -k * Mval;
-                    dF_dp2(r, c) =  k * Mval;
-                }
+  template <typename T>
+  void T_evaluate (VectorView<T> x, VectorView<T> f) const
+  {
+    using std::sqrt;
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      for (int r = 0; r < D; r++)
+        f(i*D+r) = T(mss.masses()[i].mass*mss.getGravity()(r));
 
-            // --- distribute to DF (Jacobian) ---
+    for (auto & spring : mss.springs())
+      {
+        auto [c1,c2] = spring.connectors;
+        T d[D];
+        for (int r = 0; r < D; r++)
+          {
+            T p1 = (c1.type == Connector::FIX) ? T(mss.fixes()[c1.nr].pos(r)) : x(c1.nr*D+r);
+            T p2 = (c2.type == Connector::FIX) ? T(mss.fixes()[c2.nr].pos(r)) : x(c2.nr*D+r);
+            d[r] = p2-p1;
+          }
+
+        T len2 = d[0]*d[0];
+        for (int r = 1; r < D; r++)
+          len2 += d[r]*d[r];
+        T len = sqrt(len2);
+        T fac = spring.stiffness * (len-spring.length) / len;
+
+        for (int r = 0; r < D; r++)
+          {
             if (c1.type == Connector::MASS)
-            {
-                double m1 = mss.masses()[c1.nr].mass;
-                nanoblas::Matrix<double> M(D, D), N(D, D);
-
-                // M = (1/m1) dF/dp1
-                for (int r = 0; r < D; r++)
-                    for (int c = 0; c < D; c++)
-                        M(r, c) = (1.0/m1) * dF_dp1(r, c);
-
-                writeBlock(c1.nr, c1.nr, M);
-
-                if (c2.type == Connector::MASS)
-                {
-                    for (int r = 0; r < D; r++)
-                        for (int c = 0; c < D; c++)
-                            N(r, c) = (1.0/m1) * (-dF_dp1(r, c));
-
-                    writeBlock(c1.nr, c2.nr, N);
-                }
-            }
-
+              f(c1.nr*D+r) += fac*d[r];
             if (c2.type == Connector::MASS)
-            {
-                double m2 = mss.masses()[c2.nr].mass;
-                nanoblas::Matrix<double> M(D, D), N(D, D);
-
-                // M = (1/m2) dF/dp2
-                for (int r = 0; r < D; r++)
-                    for (int c = 0; c < D; c++)
-                        M(r, c) = (1.0/m2) * dF_dp2(r, c);
-
-                writeBlock(c2.nr, c2.nr, M);
-
-                if (c1.type == Connector::MASS)
-                {
-                    for (int r = 0; r < D; r++)
-                        for (int c = 0; c < D; c++)
-                            N(r, c) = (1.0/m2) * (-dF_dp2(r, c));
-
-                    writeBlock(c2.nr, c1.nr, N);
-                }
-            }
-        }
-    }
+              f(c2.nr*D+r) -= fac*d[r];
+          }
+      }
 
+    for (size_t i = 0; i < mss.masses().size(); i++)
+      for (int r = 0; r < D; r++)
+        f(i*D+r) *= 1.0/mss.masses()[i].mass;
+  }
 };
 
+
 #endif
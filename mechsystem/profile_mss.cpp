@@ -0,0 +1,51 @@
+// count allocated bytes in the profile, in exactly one translation unit
+#define ASC_ODE_COUNT_ALLOCATIONS
+#include <fstream>
+
+#include "mass_spring.hpp"
+#include "Newmark.hpp"
+#include <implicitRK.hpp>
+
+// per-node profile of the equations of ImplicitRungeKutta and SolveODE_Alpha
+// for a chain of masses, as text on stdout and as JSON in profile_mss.json
+
+int main()
+{
+  MassSpringSystem<2> mss;
+  mss.setGravity( {0,-9.81} );
+  Connector prev = mss.addFix( { { 0.0, 0.0 } } );
+  for (size_t i = 0; i < 10; i++)
+    {
+      auto m = mss.addMass( { 1, { double(i+1), 0.0 } } );
+      mss.addSpring ( { 1, 10, { prev, m } } );
+      prev = m;
+    }
+
+  Profiler::global().enable();
+  auto forces = std::make_shared<MSS_Function<2>>(mss);
+  auto rhs = Profile(forces, "forces");
+
+  size_t n = 2*mss.masses().size();
+  Vector<> x(n), dx(n), ddx(n);
+  mss.getState (x, dx, ddx);
+  auto mass = std::make_shared<IdentityFunction> (n);
+  SolveODE_Alpha (1, 100, 0.8, x, dx, ddx, rhs, mass);
+
+  // first order system y = (x, v) for the Runge-Kutta method
+  auto ode = std::make_shared<EmbedFunction>(std::make_shared<IdentityFunction>(n), n, 2*n, 0, 2*n)
+    + std::make_shared<EmbedFunction>(Profile(forces, "forces, first order"), 0, 2*n, n, 2*n);
+  Vector<> c(3), b1(3);
+  GaussRadau (c, b1);
+  auto [a, b] = ComputeABfromC (c);
+  ImplicitRungeKutta stepper(ode, a, b, c);
+  Vector<> y(2*n);
+  mss.getState (x, dx, ddx);
+  y.range(0, n) = x;
+  y.range(n, 2*n) = dx;
+  for (int i = 0; i < 100; i++)
+    stepper.DoStep(0.01, y);
+
+  Profiler::global().report(std::cout);
+  std::ofstream json("profile_mss.json");
+  Profiler::global().reportJSON(json);
+}
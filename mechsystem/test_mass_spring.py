@@ -21,7 +21,8 @@ mss.simulate (0.1, 10)
 print ("state = ", mss.getState())
 
 
-mss.simulate (0.1, 10)
+stats = mss.simulate (0.1, 10)
+print ("Newton:", stats)
 
 print ("state = ", mss.getState())
 
@@ -1,9 +1,14 @@
 #ifndef Newton_h
 #define Newton_h
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+
 #include "nonlinfunc.hpp"
-#include <inverse.hpp>
-#include <lapack_interface.hpp>
+#include "lu.hpp"
+#include "sparselu.hpp"
 
 namespace ASC_ode
 {  
@@ -13,29 +18,413 @@ namespace ASC_ode
   {
     Vector<double> res(func->dimF());
     Matrix<double> fprime(func->dimF(), func->dimX());
+    LU<> lu(func->dimX());
 
+    double err = 0;
     for (int i = 0; i < maxsteps; i++)
       {
+        // the Jacobian only if another step follows
         func->evaluate(x, res);
-        double err= norm(res);
+        err = norm(res);
         if (err < tol) return;
 
         func->evaluateDeriv(x, fprime);
-
-        calcInverse(fprime);
-        x -= fprime*res;
-
-        // LapackLU LU(fprime);
-        // LU.solve(res);
-        // x -= res;
+        lu.factor(fprime);
+        lu.solve(res);
+        x -= res;
  
         if (callback)
           callback(i, err, x);
+
+        // the step solved the linear model, which is exact for affine functions
+        if (func->linearity() != NonlinearFunction::NONLINEAR)
+          return;
       }
 
-    throw std::domain_error("Newton did not converge");
+    throw std::domain_error("Newton did not converge, residual " + std::to_string(err)
+                            + " after " + std::to_string(maxsteps) + " steps");
   }
 
+
+  // interface of the solvers owned by the time steppers
+  class NonlinearSolver
+  {
+  public:
+    struct Stats
+    {
+      size_t solves = 0;
+      size_t iterations = 0;
+      size_t factorizations = 0;    // of Jacobians or preconditioners
+      size_t linearIterations = 0;  // of iterative linear solvers
+      double rate = 0;           // largest contraction |dx_k+1| / |dx_k|
+      double residual = 0;       // norm of the last residual
+      double timeEvaluate = 0;   // [s] in evaluate
+      double timeDeriv = 0;      // [s] in Jacobians and preconditioner setup
+      double timeSolve = 0;      // [s] in factorizations and linear solves
+
+      void add (const Stats & s)
+      {
+        solves += s.solves;
+        iterations += s.iterations;
+        factorizations += s.factorizations;
+        linearIterations += s.linearIterations;
+        rate = std::max(rate, s.rate);
+        residual = s.residual;
+        timeEvaluate += s.timeEvaluate;
+        timeDeriv += s.timeDeriv;
+        timeSolve += s.timeSolve;
+      }
+    };
+
+    virtual ~NonlinearSolver() = default;
+
+    // x is the initial guess, and the solution of func(x) = 0 on return
+    virtual void solve (std::shared_ptr<NonlinearFunction> func, VectorView<double> x) = 0;
+    // the equation changed, e.g. with the step size: drop kept Jacobians
+    virtual void invalidate() { }
+
+    /*
+      Converged when the estimated distance to the solution
+        theta/(1-theta) |dx|_w <= kappa,
+      with the contraction rate theta of the updates dx and the weighted norm
+        |dx|_w = sqrt( 1/n sum_i (dx_i / (atol + rtol |x_i|))^2 ),
+      so that the error of the solve is a fraction kappa of the tolerance.
+      Before a rate is known, the one of the last solve is taken. With
+      rtol = atol = 0 (default) the solvers test the absolute residual only.
+    */
+    void setTolerances (double rtol, double atol, double kappa = 0.1)
+    {
+      m_rtol = rtol;
+      m_atol = atol;
+      m_kappa = kappa;
+    }
+
+    // of the last solve, and summed over all solves since resetStats()
+    const Stats & stats() const { return m_stats; }
+    const Stats & totalStats() const { return m_total; }
+    void resetStats() { m_total = Stats(); }
+
+  protected:
+    Stats m_stats, m_total;
+    double m_rtol = 0, m_atol = 0, m_kappa = 0.1;
+    double m_eta = 1;   // theta/(1-theta) of the last converged solve
+
+    bool weighted() const { return m_rtol > 0 || m_atol > 0; }
+
+    double weightedNorm (VectorView<double> dx, VectorView<double> x) const
+    {
+      double sum = 0;
+      for (size_t i = 0; i < dx.size(); i++)
+        {
+          double w = dx(i) / (m_atol + m_rtol*std::abs(x(i)));
+          sum += w*w;
+        }
+      return std::sqrt(sum / dx.size());
+    }
+
+    // the test above for the weighted update dx, dxold < 0 if there is no rate
+    bool closeEnough (double dx, double dxold)
+    {
+      double eta;
+      if (dxold > 0)
+        {
+          double theta = dx / dxold;
+          if (theta >= 1) return false;
+          eta = theta / (1-theta);
+        }
+      else
+        eta = std::pow(std::max(m_eta, 1e-16), 0.8);
+      if (eta * dx > m_kappa) return false;
+      m_eta = eta;
+      return true;
+    }
+
+    static double Since (std::chrono::steady_clock::time_point start)
+    {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    }
+  };
+
+
+  /*
+    Simplified Newton: the LU factorization of the Jacobian is kept over the
+    iterations of one solve and over the following solves, for instance the
+    time steps of a stepper. It is renewed when an iteration contracts the
+    update by less than maxRate, or after invalidate(), which the owner
+    calls when the equation changed, e.g. with the step size. For affine
+    functions one step with any kept factorization in double is exact, a
+    float factorization of MIXED iterates until the residual is small.
+    The Jacobian is the one of func.evaluateDeriv, which may itself be an
+    approximation, e.g. the Kronecker form of IRKResidual: Newton then
+    converges linearly, the iterations stop at the residual or weighted
+    tolerance as usual.
+    A solve that fails with a kept factorization is repeated with a new one.
+    The buffers are allocated once, for one size of the system.
+    The linear solver is chosen with each new function: a dense LU for small
+    systems and dense patterns, otherwise SparseLU on the pattern. SparseLU
+    pivots on the diagonal only, with AUTO a zero or tiny pivot switches
+    to the dense LU for this function. SPARSE and BANDED throw instead.
+    MIXED factorizes the dense Jacobian in float, with half the memory and
+    about twice the speed. The iteration refines the corrections with the
+    residuals of evaluate in double, a slow contraction right after a float
+    factorization falls back to double until invalidate().
+  */
+  class Newton : public NonlinearSolver
+  {
+  public:
+    enum LINEARSOLVER { AUTO, DENSE, SPARSE, BANDED, MIXED };
+
+  private:
+    LINEARSOLVER m_linsolver = AUTO;
+    std::weak_ptr<NonlinearFunction> m_analyzed;    // the buffers are for this function
+    std::unique_ptr<Matrix<>> m_jac;
+    std::unique_ptr<LU<>> m_lu;
+    std::unique_ptr<LU<float>> m_luf;
+    std::unique_ptr<Vector<float>> m_resf;
+    std::unique_ptr<SparseMatrix> m_sjac;
+    std::unique_ptr<SparseLU> m_slu;
+    bool m_single = false;    // the factorization is in float
+    bool m_double = false;    // MIXED fell back to double
+    bool m_reuse = true;
+    double m_maxrate = 0.25;
+
+    void analyze (const NonlinearFunction & func, bool dense = false)
+    {
+      size_t n = func.dimX();
+      m_jac.reset();
+      m_lu.reset();
+      m_luf.reset();
+      m_resf.reset();
+      m_sjac.reset();
+      m_slu.reset();
+
+      SparsityPattern pattern;
+      bool sparse = !dense && (m_linsolver == SPARSE || m_linsolver == BANDED);
+      if (!dense && m_linsolver == AUTO && n >= 100)
+        {
+          pattern = func.pattern();
+          size_t nze = 0;
+          for (auto & row : pattern)
+            nze += row.size();
+          sparse = nze <= n*n/10;
+        }
+
+      if (sparse)
+        {
+          if (pattern.empty())
+            pattern = func.pattern();
+          pattern = MergePatterns(pattern, DiagonalPattern(n, 0, n));
+          m_sjac = std::make_unique<SparseMatrix>(pattern, n);
+          m_slu = std::make_unique<SparseLU>(pattern,
+                                             m_linsolver == SPARSE ? SparseLU::GENERAL :
+                                             m_linsolver == BANDED ? SparseLU::BANDED : SparseLU::AUTOMATIC);
+        }
+      else
+        {
+          m_jac = std::make_unique<Matrix<>>(n, n);
+          if (m_linsolver == MIXED)
+            {
+              m_luf = std::make_unique<LU<float>>(n);
+              m_resf = std::make_unique<Vector<float>>(n);
+            }
+          else
+            m_lu = std::make_unique<LU<>>(n);
+        }
+    }
+
+    void factorDense()
+    {
+      m_single = m_luf && !m_double;
+      if (m_single)
+        {
+          try
+            {
+              m_luf->factor(*m_jac);
+              return;
+            }
+          catch (std::domain_error &)
+            {
+              // singular in float
+              m_single = false;
+              m_double = true;
+            }
+        }
+      if (!m_lu)
+        m_lu = std::make_unique<LU<>>(m_jac->height());
+      m_lu->factor(*m_jac);
+    }
+
+    void solveDense()
+    {
+      if (!m_single)
+        {
+          m_lu->solve(m_res);
+          return;
+        }
+      auto & resf = *m_resf;
+      for (size_t i = 0; i < m_res.size(); i++)
+        resf(i) = m_res(i);
+      m_luf->solve(resf);
+      for (size_t i = 0; i < m_res.size(); i++)
+        m_res(i) = resf(i);
+    }
+
+  protected:
+    Vector<> m_res, m_xstart;
+    bool m_valid = false;
+    double m_tol;
+    int m_maxsteps;
+
+    // m_res = func(x), and the Jacobian at x assembled and factorized
+    void linearize (const NonlinearFunction & func, VectorView<double> x)
+    {
+      auto start = std::chrono::steady_clock::now();
+      if (m_slu)
+        {
+          func.evaluate(x, m_res);
+          func.evaluateDeriv(x, *m_sjac);
+        }
+      else
+        func.evaluateWithDeriv(x, m_res, *m_jac);
+      m_stats.timeDeriv += Since(start);
+      start = std::chrono::steady_clock::now();
+      if (m_slu)
+        {
+          try
+            {
+              m_slu->factor(*m_sjac);
+            }
+          catch (std::domain_error &)
+            {
+              if (m_linsolver != AUTO) throw;
+              // no pivot on the diagonal, the dense LU exchanges rows
+              analyze(func, true);
+              func.evaluateDeriv(x, *m_jac);
+              factorDense();
+            }
+        }
+      else
+        factorDense();
+      m_stats.timeSolve += Since(start);
+      m_valid = true;
+      m_stats.factorizations++;
+    }
+
+    void evaluate (const NonlinearFunction & func, VectorView<double> x)
+    {
+      auto start = std::chrono::steady_clock::now();
+      func.evaluate(x, m_res);
+      m_stats.timeEvaluate += Since(start);
+    }
+
+    // m_res <- J^{-1} m_res with the factorized Jacobian
+    void solveLinear()
+    {
+      auto start = std::chrono::steady_clock::now();
+      if (m_slu)
+        m_slu->solve(m_res);
+      else
+        solveDense();
+      m_stats.timeSolve += Since(start);
+    }
+
+    // true if converged within maxsteps
+    virtual bool iterate (const NonlinearFunction & func, VectorView<double> x)
+    {
+      double dxold = -1;
+      int fresh = 0;    // iterations with the current factorization
+      for (int i = 0; i < m_maxsteps; i++)
+        {
+          if (m_valid)
+            evaluate(func, x);
+          else
+            {
+              linearize(func, x);
+              fresh = 0;
+              if (m_reuse) dxold = -1;
+            }
+          m_stats.residual = norm(m_res);
+          if (m_stats.residual < m_tol) return true;
+
+          solveLinear();
+          x -= m_res;
+          m_stats.iterations++;
+          fresh++;
+
+          if (func.linearity() != NonlinearFunction::NONLINEAR && !m_single)
+            return true;
+
+          double dx = weighted() ? weightedNorm(m_res, x) : norm(m_res);
+          double rate = (dxold > 0) ? dx / dxold : 0;
+          m_stats.rate = std::max(m_stats.rate, rate);
+          if (weighted() && closeEnough(dx, dxold))
+            return true;
+          if (rate > m_maxrate && m_single && fresh <= 2)
+            m_double = true;
+          if (!m_reuse || rate > m_maxrate)
+            m_valid = false;
+          dxold = dx;
+        }
+      return false;
+    }
+
+  public:
+    Newton (size_t n, double tol = 1e-10, int maxsteps = 20)
+      : m_res(n), m_xstart(n), m_tol(tol), m_maxsteps(maxsteps) { }
+
+    void invalidate() override
+    {
+      m_valid = false;
+      m_double = false;
+    }
+    void setTolerance (double tol) { m_tol = tol; }
+    void setMaxSteps (int maxsteps) { m_maxsteps = maxsteps; }
+    // contraction rate above which the Jacobian is renewed
+    void setMaxRate (double maxrate) { m_maxrate = maxrate; }
+    // false: full Newton, a new Jacobian in every iteration
+    void setReuse (bool reuse) { m_reuse = reuse; }
+    void setLinearSolver (LINEARSOLVER linsolver)
+    {
+      m_linsolver = linsolver;
+      m_analyzed.reset();
+      m_valid = false;
+    }
+    // the sparse solver, if chosen
+    const SparseLU * sparseLU() const { return m_slu.get(); }
+    // the last factorization is in float
+    bool singlePrecision() const { return m_single; }
+
+    void solve (std::shared_ptr<NonlinearFunction> func, VectorView<double> x) override
+    {
+      m_stats = Stats();
+      m_stats.solves = 1;
+      if (!m_reuse) m_valid = false;
+      if (m_analyzed.lock() != func)
+        {
+          analyze(*func);
+          m_analyzed = func;
+          m_valid = false;
+        }
+
+      bool reused = m_valid;
+      m_xstart = x;
+      bool converged = iterate(*func, x);
+      if (!converged && ((reused && m_stats.factorizations == 0) || m_single))
+        {
+          x = m_xstart;
+          m_valid = false;
+          if (m_single) m_double = true;
+          converged = iterate(*func, x);
+        }
+
+      m_total.add(m_stats);
+      if (!converged)
+        throw std::domain_error("Newton did not converge, residual " + std::to_string(m_stats.residual)
+                                + " after " + std::to_string(m_stats.iterations) + " iterations and "
+                                + std::to_string(m_stats.factorizations) + " factorizations");
+    }
+  };
+
 }
 
 #endif
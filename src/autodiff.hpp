@@ -106,6 +106,120 @@ namespace ASC_ode
    }
 
 
+  template <size_t N, typename T = double>
+  auto operator+ (const AutoDiff<N, T>& a, T b) { return b + a; }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> operator- (const AutoDiff<N, T>& a)
+  {
+    AutoDiff<N, T> result(-a.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = -a.deriv()[i];
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> operator- (const AutoDiff<N, T>& a, const AutoDiff<N, T>& b)
+  {
+    AutoDiff<N, T> result(a.value() - b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] - b.deriv()[i];
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  auto operator- (const AutoDiff<N, T>& a, T b) { return a + (-b); }
+
+  template <size_t N, typename T = double>
+  auto operator- (T a, const AutoDiff<N, T>& b) { return a + (-b); }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> operator* (T a, const AutoDiff<N, T>& b)
+  {
+    AutoDiff<N, T> result(a * b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a * b.deriv()[i];
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  auto operator* (const AutoDiff<N, T>& a, T b) { return b * a; }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> operator/ (const AutoDiff<N, T>& a, const AutoDiff<N, T>& b)
+  {
+    AutoDiff<N, T> result(a.value() / b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = (a.deriv()[i] * b.value() - a.value() * b.deriv()[i])
+        / (b.value() * b.value());
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  auto operator/ (const AutoDiff<N, T>& a, T b) { return (1.0/b) * a; }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> operator/ (T a, const AutoDiff<N, T>& b)
+  {
+    AutoDiff<N, T> result(a / b.value());
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = -a * b.deriv()[i] / (b.value() * b.value());
+    return result;
+  }
+
+  template <size_t N, typename T = double, typename T2>
+  AutoDiff<N, T> & operator+= (AutoDiff<N, T>& a, const T2 & b) { a = a + b; return a; }
+
+  template <size_t N, typename T = double, typename T2>
+  AutoDiff<N, T> & operator-= (AutoDiff<N, T>& a, const T2 & b) { a = a - b; return a; }
+
+  template <size_t N, typename T = double, typename T2>
+  AutoDiff<N, T> & operator*= (AutoDiff<N, T>& a, const T2 & b) { a = a * b; return a; }
+
+  template <size_t N, typename T = double, typename T2>
+  AutoDiff<N, T> & operator/= (AutoDiff<N, T>& a, const T2 & b) { a = a / b; return a; }
+
+  using std::sqrt;
+  using std::exp;
+  using std::log;
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> cos(const AutoDiff<N, T> &a)
+  {
+    AutoDiff<N, T> result(cos(a.value()));
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = -sin(a.value()) * a.deriv()[i];
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> sqrt(const AutoDiff<N, T> &a)
+  {
+    AutoDiff<N, T> result(sqrt(a.value()));
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] / (2.0 * result.value());
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> exp(const AutoDiff<N, T> &a)
+  {
+    AutoDiff<N, T> result(exp(a.value()));
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = result.value() * a.deriv()[i];
+    return result;
+  }
+
+  template <size_t N, typename T = double>
+  AutoDiff<N, T> log(const AutoDiff<N, T> &a)
+  {
+    AutoDiff<N, T> result(log(a.value()));
+    for (size_t i = 0; i < N; i++)
+      result.deriv()[i] = a.deriv()[i] / a.value();
+    return result;
+  }
+
+
 } // namespace ASC_ode
 
 #endif
@@ -0,0 +1,145 @@
+#ifndef AUTODIFFFUNC_HPP
+#define AUTODIFFFUNC_HPP
+
+#include <algorithm>
+#include <memory>
+#include <type_traits>
+
+#include "nonlinfunc.hpp"
+#include "autodiff.hpp"
+#include "sparsity.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Exact derivatives from one templated evaluation, as in PendulumAD.
+    The derived class provides dimX(), dimF() and
+
+      template <typename T>
+      void T_evaluate (VectorView<T> x, VectorView<T> f) const;
+
+    The Jacobian is computed in forward mode with AutoDiff<N>. The
+    coloring is built once from pattern(), and all columns of one color
+    of the column intersection graph share a seed direction. Every pass
+    seeds N colors, so a banded or block-sparse system takes a few passes
+    independent of dimX(). pattern() is traced with SparsityTracer, unless
+    the derived class overrides it, e.g. because T_evaluate branches on
+    values of x; then the tracer is not instantiated. The coloring is kept
+    until resetPattern().
+  */
+  template <typename TDERIVED, size_t N = 8>
+  class AutoDiffFunction : public NonlinearFunction
+  {
+    mutable std::vector<AutoDiff<N>> m_xad, m_fad;
+    mutable std::vector<AutoDiff<1>> m_xdir, m_fdir;
+    mutable std::shared_ptr<ColoredJacobian> m_coloring;
+
+    const TDERIVED & derived() const { return static_cast<const TDERIVED&>(*this); }
+
+    const ColoredJacobian & coloring() const
+    {
+      if (!m_coloring || m_coloring->width() != dimX() || m_coloring->pattern().size() != dimF())
+        m_coloring = std::make_shared<ColoredJacobian>(pattern(), dimX());
+      return *m_coloring;
+    }
+
+    // all columns with colors first ... first+N, df is a MatrixView or a SparseMatrix
+    template <typename TMAT>
+    void derivPass (VectorView<double> x, size_t first, TMAT & df) const
+    {
+      auto & col = coloring();
+      size_t n = dimX(), m = dimF();
+      size_t next = std::min(first+N, col.numColors());
+      m_xad.resize(n);
+      m_fad.resize(m);
+      for (size_t j = 0; j < n; j++)
+        {
+          m_xad[j] = AutoDiff<N>(x(j));
+          size_t c = col.color(j);
+          if (c >= first && c < next)
+            m_xad[j].deriv()[c-first] = 1;
+        }
+      derived().T_evaluate(VectorView<AutoDiff<N>>(n, m_xad.data()),
+                           VectorView<AutoDiff<N>>(m, m_fad.data()));
+      for (size_t i = 0; i < m; i++)
+        for (size_t j : col.pattern()[i])
+          {
+            size_t c = col.color(j);
+            if (c >= first && c < next)
+              df(i,j) = m_fad[i].deriv()[c-first];
+          }
+    }
+
+  public:
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      derived().T_evaluate(x, f);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      for (size_t first = 0; first < coloring().numColors(); first += N)
+        derivPass(x, first, df);
+    }
+
+    // traced, if TDERIVED does not declare its own
+    SparsityPattern pattern() const override
+    {
+      if constexpr (std::is_same_v<decltype(&TDERIVED::pattern),
+                                   SparsityPattern (AutoDiffFunction::*)() const>)
+        return TracePattern(derived());
+      else
+        return NonlinearFunction::pattern();
+    }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 0.0;
+      for (size_t first = 0; first < coloring().numColors(); first += N)
+        derivPass(x, first, df);
+    }
+
+    // trace the pattern again, e.g. after springs were added
+    void resetPattern() { m_coloring = nullptr; }
+    size_t numColors() const { return coloring().numColors(); }
+
+    // the values come with the first pass
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      if (coloring().numColors() == 0)
+        {
+          evaluate(x, f);
+          df = 0.0;
+          return;
+        }
+      df = 0.0;
+      for (size_t first = 0; first < coloring().numColors(); first += N)
+        derivPass(x, first, df);
+      for (size_t i = 0; i < dimF(); i++)
+        f(i) = m_fad[i].value();
+    }
+
+    // one pass seeded with v
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      size_t n = dimX(), m = dimF();
+      m_xdir.resize(n);
+      m_fdir.resize(m);
+      for (size_t i = 0; i < n; i++)
+        {
+          m_xdir[i] = AutoDiff<1>(x(i));
+          m_xdir[i].deriv()[0] = v(i);
+        }
+      derived().T_evaluate(VectorView<AutoDiff<1>>(n, m_xdir.data()),
+                           VectorView<AutoDiff<1>>(m, m_fdir.data()));
+      for (size_t i = 0; i < m; i++)
+        Jv(i) = m_fdir[i].deriv()[0];
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef BROYDEN_HPP
+#define BROYDEN_HPP
+
+#include "Newton.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Good Broyden: the Jacobian J0 is assembled and factorized as in Newton,
+    but only occasionally. In between, the iteration uses the secant updates
+      B_k+1 = B_k + (f(x_k+1) - f(x_k) - B_k s_k) s_k^T / (s_k^T s_k)
+    of the steps s_k. They are applied to the factorization of J0 by the
+    Sherman-Morrison formula, with the steps as the only storage (Kelley,
+    Iterative Methods for Linear and Nonlinear Equations, brsol): a step
+    costs one solve with J0 and 2k inner products.
+    After maxUpdates steps B restarts from J0. A growing residual restarts
+    from a new Jacobian at the current iterate. The choice of the linear
+    solver and the reuse of J0 over the solves are those of Newton.
+  */
+  class Broyden : public Newton
+  {
+    Matrix<> m_steps;     // s_k in the rows
+    Vector<> m_snorm2;    // s_k^T s_k
+    size_t m_maxupdates;
+
+    static double Dot (VectorView<double> a, VectorView<double> b)
+    {
+      double sum = 0;
+      for (size_t i = 0; i < a.size(); i++)
+        sum += a(i) * b(i);
+      return sum;
+    }
+
+  protected:
+    bool iterate (const NonlinearFunction & func, VectorView<double> x) override
+    {
+      size_t k = 0;      // steps since B = J0
+      double resold = -1, dxold = -1;
+      for (int i = 0; i < m_maxsteps; i++)
+        {
+          if (m_valid)
+            evaluate(func, x);
+          else
+            {
+              linearize(func, x);
+              k = 0;
+              resold = -1;
+              dxold = -1;
+            }
+          m_stats.residual = norm(m_res);
+          if (m_stats.residual < m_tol) return true;
+          if (resold >= 0 && m_stats.residual > resold)
+            {
+              m_valid = false;
+              continue;
+            }
+          resold = m_stats.residual;
+
+          // s_k = -B_k^{-1} f(x_k)
+          solveLinear();
+          auto s = m_steps.row(k);
+          s = (-1.0) * m_res;
+          for (size_t j = 0; j+1 < k; j++)
+            s += (Dot(m_steps.row(j), s) / m_snorm2(j)) * m_steps.row(j+1);
+          if (k > 0)
+            s *= 1 / (1 - Dot(m_steps.row(k-1), s) / m_snorm2(k-1));
+          m_snorm2(k) = Dot(s, s);
+          x += s;
+          m_stats.iterations++;
+
+          // with B = J0 in double the step is exact for affine functions
+          if (k == 0 && func.linearity() != NonlinearFunction::NONLINEAR && !singlePrecision())
+            return true;
+
+          double dx = weighted() ? weightedNorm(s, x) : norm(s);
+          if (dxold > 0)
+            m_stats.rate = std::max(m_stats.rate, dx / dxold);
+          if (weighted() && closeEnough(dx, dxold))
+            return true;
+          dxold = dx;
+
+          if (++k == m_maxupdates)
+            k = 0;
+        }
+      return false;
+    }
+
+  public:
+    Broyden (size_t n, double tol = 1e-10, int maxsteps = 50, size_t maxupdates = 20)
+      : Newton(n, tol, maxsteps), m_steps(maxupdates, n), m_snorm2(maxupdates),
+        m_maxupdates(maxupdates) { }
+  };
+
+}
+
+#endif
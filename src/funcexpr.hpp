@@ -0,0 +1,293 @@
+#ifndef FUNCEXPR_HPP
+#define FUNCEXPR_HPP
+
+#include <algorithm>
+#include <type_traits>
+
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Statically typed counterpart of the shared_ptr function tree.
+    An expression like  ynew - yold - tau*rhs  is a single type, all
+    evaluate/evaluateDeriv calls are resolved at compile time and can
+    be inlined. ExprFunction wraps an expression as a NonlinearFunction
+    for the time steppers and NewtonSolver. setTime, isTimeDependent and
+    linearity go through the nodes to the FunctionExpr leaves, as through
+    the children of the shared_ptr tree.
+  */
+
+  template <typename T>
+  class FuncExpr
+  {
+  public:
+    const T & derived() const { return static_cast<const T&>(*this); }
+    size_t dimX() const { return derived().dimX(); }
+    size_t dimF() const { return derived().dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const
+    {
+      derived().evaluate(x, f);
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+    {
+      derived().evaluateDeriv(x, df);
+    }
+    // the leaves are shared, the nodes themselves have no state in time
+    void setTime (double t) const { derived().setTime(t); }
+    bool isTimeDependent() const { return derived().isTimeDependent(); }
+    NonlinearFunction::LINEARITY linearity() const { return derived().linearity(); }
+  };
+
+
+  class IdentityExpr : public FuncExpr<IdentityExpr>
+  {
+    size_t m_n;
+  public:
+    IdentityExpr (size_t n) : m_n(n) { }
+    size_t dimX() const { return m_n; }
+    size_t dimF() const { return m_n; }
+    void evaluate (VectorView<double> x, VectorView<double> f) const
+    {
+      f = x;
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+    {
+      df = 0.0;
+      df.diag() = 1.0;
+    }
+    void setTime (double t) const { }
+    bool isTimeDependent() const { return false; }
+    NonlinearFunction::LINEARITY linearity() const { return NonlinearFunction::LINEAR; }
+  };
+
+
+  // refers to a ConstantFunction, so that steppers can still set() it
+  class ConstantExpr : public FuncExpr<ConstantExpr>
+  {
+    std::shared_ptr<ConstantFunction> m_c;
+  public:
+    ConstantExpr (std::shared_ptr<ConstantFunction> c) : m_c(c) { }
+    size_t dimX() const { return m_c->dimX(); }
+    size_t dimF() const { return m_c->dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const
+    {
+      f = m_c->get();
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+    {
+      df = 0.0;
+    }
+    void setTime (double t) const { }
+    bool isTimeDependent() const { return false; }
+    NonlinearFunction::LINEARITY linearity() const { return NonlinearFunction::AFFINE; }
+  };
+
+
+  // leaf calling a user function. For a concrete class TF the call is
+  // qualified and thus not virtual, a TimeDependentFunction is called at
+  // the time set last.
+  template <typename TF>
+  class FunctionExpr : public FuncExpr<FunctionExpr<TF>>
+  {
+    std::shared_ptr<TF> m_f;
+    static constexpr bool TimeDependent = std::is_base_of_v<TimeDependentFunction, TF>;
+  public:
+    FunctionExpr (std::shared_ptr<TF> f) : m_f(f) { }
+    size_t dimX() const { return m_f->dimX(); }
+    size_t dimF() const { return m_f->dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const
+    {
+      if constexpr (std::is_abstract_v<TF>)
+        m_f->evaluate(x, f);
+      else if constexpr (TimeDependent)
+        m_f->TF::evaluate(m_f->time(), x, f);
+      else
+        m_f->TF::evaluate(x, f);
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+    {
+      if constexpr (std::is_abstract_v<TF>)
+        m_f->evaluateDeriv(x, df);
+      else if constexpr (TimeDependent)
+        m_f->TF::evaluateDeriv(m_f->time(), x, df);
+      else
+        m_f->TF::evaluateDeriv(x, df);
+    }
+    void setTime (double t) const { m_f->setTime(t); }
+    bool isTimeDependent() const { return m_f->isTimeDependent(); }
+    NonlinearFunction::LINEARITY linearity() const { return m_f->linearity(); }
+  };
+
+
+  template <typename TA, typename TB>
+  class SumExpr : public FuncExpr<SumExpr<TA,TB>>
+  {
+    TA m_a;
+    TB m_b;
+    double m_faca, m_facb;
+    Workspace m_ws;
+  public:
+    SumExpr (const TA & a, const TB & b, double faca, double facb)
+      : m_a(a), m_b(b), m_faca(faca), m_facb(facb) { }
+    size_t dimX() const { return m_a.dimX(); }
+    size_t dimF() const { return m_a.dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const
+    {
+      m_a.evaluate(x, f);
+      f *= m_faca;
+      auto tmp = m_ws.vec(0, dimF());
+      m_b.evaluate(x, tmp);
+      f += m_facb*tmp;
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+    {
+      m_a.evaluateDeriv(x, df);
+      df *= m_faca;
+      auto tmp = m_ws.mat(1, dimF(), dimX());
+      m_b.evaluateDeriv(x, tmp);
+      df += m_facb*tmp;
+    }
+    void setTime (double t) const { m_a.setTime(t); m_b.setTime(t); }
+    bool isTimeDependent() const { return m_a.isTimeDependent() || m_b.isTimeDependent(); }
+    NonlinearFunction::LINEARITY linearity() const { return std::max(m_a.linearity(), m_b.linearity()); }
+  };
+
+
+  // factor is a double or a std::shared_ptr<Parameter>
+  template <typename TA, typename TFAC>
+  class ScaleExpr : public FuncExpr<ScaleExpr<TA,TFAC>>
+  {
+    TA m_a;
+    TFAC m_fac;
+
+    double factor() const
+    {
+      if constexpr (std::is_same_v<TFAC,double>)
+        return m_fac;
+      else
+        return m_fac->get();
+    }
+  public:
+    ScaleExpr (const TA & a, TFAC fac) : m_a(a), m_fac(fac) { }
+    size_t dimX() const { return m_a.dimX(); }
+    size_t dimF() const { return m_a.dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const
+    {
+      m_a.evaluate(x, f);
+      f *= factor();
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+    {
+      m_a.evaluateDeriv(x, df);
+      df *= factor();
+    }
+    void setTime (double t) const { m_a.setTime(t); }
+    bool isTimeDependent() const { return m_a.isTimeDependent(); }
+    NonlinearFunction::LINEARITY linearity() const { return m_a.linearity(); }
+  };
+
+
+  // a(b)
+  template <typename TA, typename TB>
+  class ComposeExpr : public FuncExpr<ComposeExpr<TA,TB>>
+  {
+    TA m_a;
+    TB m_b;
+    Workspace m_ws;
+  public:
+    ComposeExpr (const TA & a, const TB & b) : m_a(a), m_b(b) { }
+    size_t dimX() const { return m_b.dimX(); }
+    size_t dimF() const { return m_a.dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const
+    {
+      auto tmp = m_ws.vec(0, m_b.dimF());
+      m_b.evaluate(x, tmp);
+      m_a.evaluate(tmp, f);
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const
+    {
+      auto tmp = m_ws.vec(0, m_b.dimF());
+      auto jaca = m_ws.mat(1, m_a.dimF(), m_a.dimX());
+      auto jacb = m_ws.mat(2, m_b.dimF(), m_b.dimX());
+      m_b.evaluate(x, tmp);
+      m_b.evaluateDeriv(x, jacb);
+      m_a.evaluateDeriv(tmp, jaca);
+      MultiplyJacobians(jaca, jacb, df);
+    }
+    void setTime (double t) const { m_a.setTime(t); m_b.setTime(t); }
+    bool isTimeDependent() const { return m_a.isTimeDependent() || m_b.isTimeDependent(); }
+    NonlinearFunction::LINEARITY linearity() const { return std::max(m_a.linearity(), m_b.linearity()); }
+  };
+
+
+  // leaves from the shared_ptr world
+  inline auto Expr (std::shared_ptr<ConstantFunction> c) { return ConstantExpr(c); }
+
+  template <typename TF>
+  auto Expr (std::shared_ptr<TF> f) { return FunctionExpr<TF>(f); }
+
+
+  template <typename TA, typename TB>
+  auto operator+ (const FuncExpr<TA> & a, const FuncExpr<TB> & b)
+  {
+    return SumExpr<TA,TB>(a.derived(), b.derived(), 1, 1);
+  }
+
+  template <typename TA, typename TB>
+  auto operator- (const FuncExpr<TA> & a, const FuncExpr<TB> & b)
+  {
+    return SumExpr<TA,TB>(a.derived(), b.derived(), 1, -1);
+  }
+
+  template <typename TA>
+  auto operator* (double fac, const FuncExpr<TA> & a)
+  {
+    return ScaleExpr<TA,double>(a.derived(), fac);
+  }
+
+  template <typename TA>
+  auto operator* (std::shared_ptr<Parameter> fac, const FuncExpr<TA> & a)
+  {
+    return ScaleExpr<TA,std::shared_ptr<Parameter>>(a.derived(), fac);
+  }
+
+  template <typename TA, typename TB>
+  auto Compose (const FuncExpr<TA> & a, const FuncExpr<TB> & b)
+  {
+    return ComposeExpr<TA,TB>(a.derived(), b.derived());
+  }
+
+
+  // type-erasing adapter back to the NonlinearFunction interface
+  template <typename T>
+  class ExprFunction : public NonlinearFunction
+  {
+    T m_expr;
+  public:
+    ExprFunction (const FuncExpr<T> & expr) : m_expr(expr.derived()) { }
+    size_t dimX() const override { return m_expr.dimX(); }
+    size_t dimF() const override { return m_expr.dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      m_expr.evaluate(x, f);
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      m_expr.evaluateDeriv(x, df);
+    }
+    void setTime (double t) override { m_expr.setTime(t); }
+    bool isTimeDependent() const override { return m_expr.isTimeDependent(); }
+    LINEARITY linearity() const override { return m_expr.linearity(); }
+  };
+
+  template <typename T>
+  std::shared_ptr<NonlinearFunction> MakeFunction (const FuncExpr<T> & expr)
+  {
+    return std::make_shared<ExprFunction<T>>(expr);
+  }
+
+}
+
+#endif
@@ -1,50 +1,781 @@
 #ifndef IMPLICITRK_HPP
 #define IMPLICITRK_HPP
 
+#include <algorithm>
+#include <complex>
+#include <exception>
+#include <system_error>
+#include <thread>
+
 #include <vector.hpp>
 #include <matrix.hpp>
 #include <inverse.hpp>
 
+#include "timestepper.hpp"
+
 namespace ASC_ode {
   using namespace nanoblas;
 
 
+  /*
+    Stage equations  G(k) = k - f(y + tau (A x I) k)  of an implicit
+    Runge-Kutta step, for the stage derivatives k = (k_1, ..., k_s).
+    The derivatives are NOT the ones of G by default: they use the Kronecker
+    form  I - tau (A x J)  with the Jacobian J of f at y and t of the step
+    for all stages, as in simplified Newton. It costs one evaluation of J
+    instead of s, with no products of dense s n x s n matrices. The sparse
+    and matrix-free derivatives need storage of the size of J only. This
+    equals dG/dk for f affine with a constant J, otherwise Newton converges
+    linearly. setExactJacobian(true) gives dG/dk, with block row i
+    -tau a_ij J(Y_i) at the stage values Y_i and times t + c_i tau.
+  */
+  class IRKResidual : public NonlinearFunction
+  {
+    std::shared_ptr<NonlinearFunction> m_rhs;
+    bool m_timedependent;
+    Matrix<> m_a;
+    Vector<> m_c;
+    size_t m_s, m_n;
+    double m_t = 0, m_tau = 0;
+    Vector<> m_y;
+    bool m_exact = false;       // derivatives at the stage values
+    Workspace m_ws;
+
+    auto stage (VectorView<double> v, size_t i) const { return v.range(i*m_n, (i+1)*m_n); }
+
+    // yi = Y_i = y + tau sum_j a_ij k_j
+    void stageValue (VectorView<double> k, size_t i, VectorView<double> yi) const
+    {
+      yi = m_y;
+      for (size_t j = 0; j < m_s; j++)
+        if (m_a(i,j) != 0.0)
+          yi += (m_tau*m_a(i,j)) * stage(k, j);
+    }
+
+    // the Jacobian is the one at the start of the step
+    void setJacobianTime() const
+    {
+      if (m_timedependent) m_rhs->setTime(m_t);
+    }
+
+  public:
+    IRKResidual (std::shared_ptr<NonlinearFunction> rhs, const Matrix<> & a, const Vector<> & c)
+      : m_rhs(rhs), m_timedependent(rhs->isTimeDependent()),
+        m_a(a), m_c(c), m_s(c.size()), m_n(rhs->dimX()), m_y(rhs->dimX()) { }
+
+    // the step from y at time t
+    void setStep (double t, double tau, VectorView<double> y)
+    {
+      m_t = t;
+      m_tau = tau;
+      m_y = y;
+    }
+    double tau() const { return m_tau; }
+    // the true derivatives of G, with s evaluations of J
+    void setExactJacobian (bool exact) { m_exact = exact; }
+    bool exactJacobian() const { return m_exact; }
+    const Matrix<> & a() const { return m_a; }
+    size_t stages() const { return m_s; }
+
+    // the Jacobian J of f in I - tau (A x J), at y and t of the step
+    void rhsJacobian (MatrixView<double> jac) const
+    {
+      setJacobianTime();
+      m_rhs->evaluateDeriv(m_y, jac);
+    }
+
+    size_t dimX() const override { return m_s*m_n; }
+    size_t dimF() const override { return m_s*m_n; }
+
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { m_rhs }; }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      auto copy = std::make_shared<IRKResidual>(*this);
+      copy->m_rhs = funcs[0];
+      return copy;
+    }
+    // the stage times come from setStep
+    void setTime (double t) override { }
+    bool isTimeDependent() const override { return m_timedependent; }
+    bool isInvariant() const override { return false; }
+    // the Kronecker form of a time-dependent J is not the derivative
+    LINEARITY linearity() const override
+    {
+      if (m_rhs->linearity() == NONLINEAR || (m_timedependent && !m_exact))
+        return NONLINEAR;
+      return AFFINE;
+    }
+
+    // one batch of the s stage values, or one call per stage at its time
+    void evaluate (VectorView<double> k, VectorView<double> f) const override
+    {
+      if (m_timedependent)
+        {
+          auto yi = m_ws.vec(0, m_n);
+          for (size_t i = 0; i < m_s; i++)
+            {
+              stageValue(k, i, yi);
+              m_rhs->setTime(m_t + m_c(i)*m_tau);
+              m_rhs->evaluate(yi, stage(f, i));
+            }
+        }
+      else
+        {
+          auto ys = m_ws.mat(1, m_n, m_s);
+          auto fs = m_ws.mat(2, m_n, m_s);
+          for (size_t r = 0; r < m_n; r++)
+            for (size_t i = 0; i < m_s; i++)
+              {
+                double sum = m_y(r);
+                for (size_t j = 0; j < m_s; j++)
+                  sum += m_tau*m_a(i,j) * k(j*m_n+r);
+                ys(r,i) = sum;
+              }
+          m_rhs->evaluateBatch(ys, fs);
+          for (size_t i = 0; i < m_s; i++)
+            for (size_t r = 0; r < m_n; r++)
+              f(i*m_n+r) = fs(r,i);
+        }
+      for (size_t i = 0; i < f.size(); i++)
+        f(i) = k(i) - f(i);
+    }
+
+    void evaluateDeriv (VectorView<double> k, MatrixView<double> df) const override
+    {
+      auto jac = m_ws.mat(3, m_n, m_n);
+      auto yi = m_ws.vec(0, m_n);
+      if (!m_exact)
+        rhsJacobian(jac);
+      df = 0.0;
+      for (size_t i = 0; i < m_s; i++)
+        {
+          if (m_exact)
+            {
+              stageValue(k, i, yi);
+              if (m_timedependent) m_rhs->setTime(m_t + m_c(i)*m_tau);
+              m_rhs->evaluateDeriv(yi, jac);
+            }
+          for (size_t j = 0; j < m_s; j++)
+            {
+              double fac = -m_tau*m_a(i,j);
+              if (fac == 0.0) continue;
+              for (size_t r = 0; r < m_n; r++)
+                for (size_t c = 0; c < m_n; c++)
+                  df(i*m_n+r, j*m_n+c) = fac * jac(r,c);
+            }
+        }
+      for (size_t i = 0; i < m_s*m_n; i++)
+        df(i,i) += 1;
+    }
+
+    // v - tau (A x J) v  with s products of J
+    void applyDeriv (VectorView<double> k, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      auto u = m_ws.vec(4, m_n);
+      auto ju = m_ws.vec(5, m_n);
+      auto yi = m_ws.vec(0, m_n);
+      setJacobianTime();
+      for (size_t i = 0; i < m_s; i++)
+        {
+          u = 0.0;
+          for (size_t j = 0; j < m_s; j++)
+            if (m_a(i,j) != 0.0)
+              u += m_a(i,j) * stage(v, j);
+          if (m_exact)
+            {
+              stageValue(k, i, yi);
+              if (m_timedependent) m_rhs->setTime(m_t + m_c(i)*m_tau);
+              m_rhs->applyDeriv(yi, u, ju);
+            }
+          else
+            m_rhs->applyDeriv(m_y, u, ju);
+          stage(Jv, i) = stage(v, i) - m_tau * ju;
+        }
+    }
+
+    // w - tau (A^T x J^T) w, exact: w_j - tau sum_i a_ij J(Y_i)^T w_i
+    void applyDerivTranspose (VectorView<double> k, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      auto u = m_ws.vec(4, m_n);
+      auto ju = m_ws.vec(5, m_n);
+      auto yi = m_ws.vec(0, m_n);
+      if (m_exact)
+        {
+          JTw = w;
+          for (size_t i = 0; i < m_s; i++)
+            {
+              stageValue(k, i, yi);
+              if (m_timedependent) m_rhs->setTime(m_t + m_c(i)*m_tau);
+              m_rhs->applyDerivTranspose(yi, stage(w, i), ju);
+              for (size_t j = 0; j < m_s; j++)
+                if (m_a(i,j) != 0.0)
+                  stage(JTw, j) -= (m_tau*m_a(i,j)) * ju;
+            }
+          return;
+        }
+
+      setJacobianTime();
+      for (size_t i = 0; i < m_s; i++)
+        {
+          u = 0.0;
+          for (size_t j = 0; j < m_s; j++)
+            if (m_a(j,i) != 0.0)
+              u += m_a(j,i) * stage(w, j);
+          m_rhs->applyDerivTranspose(m_y, u, ju);
+          stage(JTw, i) = stage(w, i) - m_tau * ju;
+        }
+    }
+
+    // the pattern of J in the blocks with a_ij != 0, and the diagonal
+    SparsityPattern pattern() const override
+    {
+      auto pj = m_rhs->pattern();
+      SparsityPattern pattern(m_s*m_n);
+      for (size_t i = 0; i < m_s; i++)
+        for (size_t r = 0; r < m_n; r++)
+          {
+            auto & row = pattern[i*m_n+r];
+            row.push_back(i*m_n+r);
+            for (size_t j = 0; j < m_s; j++)
+              if (m_a(i,j) != 0.0)
+                for (size_t c : pj[r])
+                  row.push_back(j*m_n+c);
+            std::sort(row.begin(), row.end());
+            row.erase(std::unique(row.begin(), row.end()), row.end());
+          }
+      return pattern;
+    }
+
+    void evaluateDeriv (VectorView<double> k, SparseMatrix & df) const override
+    {
+      auto & jac = m_ws.sparse(0, *m_rhs);
+      auto yi = m_ws.vec(0, m_n);
+      if (!m_exact)
+        {
+          setJacobianTime();
+          m_rhs->evaluateDeriv(m_y, jac);
+        }
+      df = 0.0;
+      for (size_t i = 0; i < m_s; i++)
+        {
+          if (m_exact)
+            {
+              stageValue(k, i, yi);
+              if (m_timedependent) m_rhs->setTime(m_t + m_c(i)*m_tau);
+              m_rhs->evaluateDeriv(yi, jac);
+            }
+          for (size_t j = 0; j < m_s; j++)
+            if (m_a(i,j) != 0.0)
+              df.addScaled(-m_tau*m_a(i,j), jac, i*m_n, j*m_n);
+        }
+      for (size_t i = 0; i < m_s*m_n; i++)
+        df(i,i) += 1;
+    }
+  };
+
+
+  /*
+    Simplified Newton for the stage equations  k - f(y + tau (A x I) k) = 0
+    of ImplicitRungeKutta, with the Jacobian  I - tau (A x J)  of the
+    IRKResidual, A, tau and J at y come from there. A is diagonalized once, T^{-1} A T is diagonal
+    with 2x2 blocks for complex conjugate pairs, so that an iteration solves
+    ceil(s/2) independent n x n systems  (I - tau mu J) w = u,  complex for
+    the pairs, instead of one of size s n. The blocks are factorized in
+    parallel threads if they are large enough, see parallelFactor.
+    Created by the stepper for its residual:
+      stepper.useButcherTransform();
+  */
+  class ButcherNewton : public NonlinearSolver
+  {
+    using Complex = std::complex<double>;
+
+    struct Block
+    {
+      size_t col;     // first column of T
+      Complex mu;     // eigenvalue, of the system (I - tau mu J)
+      std::unique_ptr<Matrix<>> mat;
+      std::unique_ptr<LU<>> lu;
+      std::unique_ptr<Matrix<Complex>> cmat;
+      std::unique_ptr<LU<Complex>> clu;
+      std::unique_ptr<Vector<Complex>> cvec;
+    };
+
+    std::shared_ptr<IRKResidual> m_residual;
+    size_t m_s, m_n;
+    Matrix<> m_T, m_Tinv;
+    std::vector<Block> m_blocks;
+    Matrix<> m_jac;
+    Vector<> m_res, m_u, m_kstart;
+    double m_tau = 0;       // of the factorization
+    bool m_valid = false;
+    bool m_parallel = true;
+    double m_tol;
+    int m_maxsteps;
+    double m_maxrate = 0.25;
+
+    // Spawning and joining a thread costs about 20 us, a real LU of size 96
+    // about 300 us, a complex one four times that. The solves with the
+    // factors take below 40 us up to n = 200 and stay serial.
+    static constexpr size_t ParallelSize = 96;
+
+    bool parallelFactor() const
+    {
+      return m_parallel && m_blocks.size() > 1 && m_n >= ParallelSize
+        && std::thread::hardware_concurrency() > 1;
+    }
+
+    // T and the blocks from the eigenvalues of A: the roots of the
+    // characteristic polynomial, by Faddeev-LeVerrier and Durand-Kerner,
+    // and the eigenvectors by inverse iteration
+    void analyze (const Matrix<> & a)
+    {
+      size_t s = m_s;
+      std::vector<double> coef(s+1);   // det(z I - A) = sum coef[k] z^k
+      coef[s] = 1;
+      Matrix<> M(s, s), AM(s, s);
+      M = 0.0;
+      for (size_t k = 1; k <= s; k++)
+        {
+          for (size_t i = 0; i < s; i++)
+            M(i,i) += coef[s-k+1];
+          double trace = 0;
+          for (size_t i = 0; i < s; i++)
+            for (size_t j = 0; j < s; j++)
+              {
+                double sum = 0;
+                for (size_t l = 0; l < s; l++)
+                  sum += a(i,l) * M(l,j);
+                AM(i,j) = sum;
+              }
+          for (size_t i = 0; i < s; i++)
+            trace += AM(i,i);
+          coef[s-k] = -trace / k;
+          for (size_t i = 0; i < s; i++)
+            for (size_t j = 0; j < s; j++)
+              M(i,j) = AM(i,j);
+        }
+
+      auto poly = [&](Complex z)
+      {
+        Complex p = 0;
+        for (size_t k = s+1; k-- > 0; )
+          p = p*z + coef[k];
+        return p;
+      };
+      std::vector<Complex> roots(s);
+      for (size_t j = 0; j < s; j++)
+        roots[j] = std::pow(Complex(0.4, 0.9), double(j));
+      for (int it = 0; it < 500; it++)
+        {
+          double change = 0;
+          for (size_t j = 0; j < s; j++)
+            {
+              Complex denom = 1;
+              for (size_t l = 0; l < s; l++)
+                if (l != j) denom *= roots[j]-roots[l];
+              Complex delta = poly(roots[j]) / denom;
+              roots[j] -= delta;
+              change = std::max(change, std::abs(delta));
+            }
+          if (change < 1e-15) break;
+        }
+
+      m_T = 0.0;
+      size_t col = 0;
+      for (auto lam : roots)
+        {
+          bool real = std::abs(lam.imag()) < 1e-10 * std::abs(lam);
+          if (!real && lam.imag() < 0) continue;
+          if (real) lam = lam.real();
+
+          // v = (A - lam I)^{-1} e, twice, is the eigenvector
+          Matrix<Complex> shifted(s, s);
+          for (size_t i = 0; i < s; i++)
+            for (size_t j = 0; j < s; j++)
+              shifted(i,j) = a(i,j) - (i == j ? lam*(1+1e-12) : Complex(0));
+          LU<Complex> lu(s);
+          lu.factor(shifted);
+          Vector<Complex> v(s);
+          for (size_t i = 0; i < s; i++)
+            v(i) = 1;
+          for (int it = 0; it < 2; it++)
+            {
+              lu.solve(v);
+              double vnorm = 0;
+              for (size_t i = 0; i < s; i++)
+                vnorm = std::max(vnorm, std::abs(v(i)));
+              for (size_t i = 0; i < s; i++)
+                v(i) /= vnorm;
+            }
+
+          // A (p + i q) = (alpha + i beta)(p + i q)  gives the 2x2 block
+          // ((alpha, beta), (-beta, alpha)) and the system (I - tau conj(lam) J)
+          Block block;
+          block.col = col;
+          block.mu = std::conj(lam);
+          for (size_t i = 0; i < s; i++)
+            m_T(i, col) = v(i).real();
+          if (!real)
+            for (size_t i = 0; i < s; i++)
+              m_T(i, col+1) = v(i).imag();
+          col += real ? 1 : 2;
+          m_blocks.push_back(std::move(block));
+        }
+      if (col != s)
+        throw std::domain_error("ButcherNewton: cannot diagonalize A");
+
+      LU<> lu(s);
+      lu.factor(m_T);
+      Vector<> e(s);
+      for (size_t j = 0; j < s; j++)
+        {
+          e = 0.0;
+          e(j) = 1;
+          lu.solve(e);
+          for (size_t i = 0; i < s; i++)
+            m_Tinv(i,j) = e(i);
+        }
+    }
+
+    // one thread per block if parallel. An exception of a block is
+    // rethrown after all threads are joined, blocks without a thread run here.
+    template <typename FUNC>
+    void forBlocks (FUNC func, bool parallel)
+    {
+      if (!parallel)
+        {
+          for (auto & block : m_blocks)
+            func(block);
+          return;
+        }
+
+      std::vector<std::exception_ptr> errors(m_blocks.size());
+      auto run = [this, &func, &errors] (size_t b)
+      {
+        try
+          {
+            func(m_blocks[b]);
+          }
+        catch (...)
+          {
+            errors[b] = std::current_exception();
+          }
+      };
+      std::vector<std::thread> threads;
+      try
+        {
+          for (size_t b = 1; b < m_blocks.size(); b++)
+            threads.emplace_back(run, b);
+        }
+      catch (std::system_error &) { }
+      run(0);
+      for (size_t b = threads.size()+1; b < m_blocks.size(); b++)
+        run(b);
+      for (auto & thread : threads)
+        thread.join();
+      for (auto & error : errors)
+        if (error) std::rethrow_exception(error);
+    }
+
+    void factor()
+    {
+      auto start = std::chrono::steady_clock::now();
+      m_tau = m_residual->tau();
+      m_residual->rhsJacobian(m_jac);
+      m_stats.timeDeriv += Since(start);
+
+      start = std::chrono::steady_clock::now();
+      forBlocks([this] (Block & block)
+      {
+        Complex fac = m_tau * block.mu;
+        if (block.lu)
+          {
+            auto & mat = *block.mat;
+            for (size_t i = 0; i < m_n; i++)
+              for (size_t j = 0; j < m_n; j++)
+                mat(i,j) = (i == j ? 1.0 : 0.0) - fac.real() * m_jac(i,j);
+            block.lu->factor(mat);
+          }
+        else
+          {
+            auto & mat = *block.cmat;
+            for (size_t i = 0; i < m_n; i++)
+              for (size_t j = 0; j < m_n; j++)
+                mat(i,j) = (i == j ? 1.0 : 0.0) - fac * m_jac(i,j);
+            block.clu->factor(mat);
+          }
+      }, parallelFactor());
+      m_stats.timeSolve += Since(start);
+      m_valid = true;
+      m_stats.factorizations++;
+    }
+
+    // m_res <- (T x I) (I - tau Lambda x J)^{-1} (T^{-1} x I) m_res
+    void solveLinear()
+    {
+      auto start = std::chrono::steady_clock::now();
+      auto stage = [this] (VectorView<double> v, size_t i) { return v.range(i*m_n, (i+1)*m_n); };
+      for (size_t i = 0; i < m_s; i++)
+        {
+          stage(m_u, i) = 0.0;
+          for (size_t j = 0; j < m_s; j++)
+            stage(m_u, i) += m_Tinv(i,j) * stage(m_res, j);
+        }
+
+      forBlocks([this, stage] (Block & block)
+      {
+        auto w = stage(m_u, block.col);
+        if (block.lu)
+          {
+            block.lu->solve(w);
+            return;
+          }
+        auto w2 = stage(m_u, block.col+1);
+        auto & z = *block.cvec;
+        for (size_t i = 0; i < m_n; i++)
+          z(i) = Complex(w(i), w2(i));
+        block.clu->solve(z);
+        for (size_t i = 0; i < m_n; i++)
+          {
+            w(i) = z(i).real();
+            w2(i) = z(i).imag();
+          }
+      }, false);
+
+      for (size_t i = 0; i < m_s; i++)
+        {
+          stage(m_res, i) = 0.0;
+          for (size_t j = 0; j < m_s; j++)
+            stage(m_res, i) += m_T(i,j) * stage(m_u, j);
+        }
+      m_stats.timeSolve += Since(start);
+    }
+
+    bool iterate (const NonlinearFunction & func, VectorView<double> k)
+    {
+      double dxold = -1;
+      for (int i = 0; i < m_maxsteps; i++)
+        {
+          if (!m_valid)
+            {
+              factor();
+              dxold = -1;
+            }
+          auto start = std::chrono::steady_clock::now();
+          func.evaluate(k, m_res);
+          m_stats.timeEvaluate += Since(start);
+          m_stats.residual = norm(m_res);
+          if (m_stats.residual < m_tol) return true;
+
+          solveLinear();
+          k -= m_res;
+          m_stats.iterations++;
+          if (func.linearity() != NonlinearFunction::NONLINEAR)
+            return true;
+
+          double dx = weighted() ? weightedNorm(m_res, k) : norm(m_res);
+          double rate = (dxold > 0) ? dx / dxold : 0;
+          m_stats.rate = std::max(m_stats.rate, rate);
+          if (weighted() && closeEnough(dx, dxold))
+            return true;
+          if (rate > m_maxrate)
+            m_valid = false;
+          dxold = dx;
+        }
+      return false;
+    }
+
+  public:
+    ButcherNewton (std::shared_ptr<IRKResidual> residual, double tol = 1e-10, int maxsteps = 20)
+      : m_residual(residual), m_s(residual->stages()), m_n(residual->dimX()/m_s),
+        m_T(m_s, m_s), m_Tinv(m_s, m_s), m_jac(m_n, m_n),
+        m_res(m_s*m_n), m_u(m_s*m_n), m_kstart(m_s*m_n),
+        m_tol(tol), m_maxsteps(maxsteps)
+    {
+      analyze(residual->a());
+      for (auto & block : m_blocks)
+        if (block.mu.imag() == 0)
+          {
+            block.mat = std::make_unique<Matrix<>>(m_n, m_n);
+            block.lu = std::make_unique<LU<>>(m_n);
+          }
+        else
+          {
+            block.cmat = std::make_unique<Matrix<Complex>>(m_n, m_n);
+            block.clu = std::make_unique<LU<Complex>>(m_n);
+            block.cvec = std::make_unique<Vector<Complex>>(m_n);
+          }
+    }
+
+    void invalidate() override { m_valid = false; }
+    void setTolerance (double tol) { m_tol = tol; }
+    void setMaxSteps (int maxsteps) { m_maxsteps = maxsteps; }
+    void setMaxRate (double maxrate) { m_maxrate = maxrate; }
+    // factorize the blocks in threads, for n >= ParallelSize on several cores
+    void setParallel (bool parallel) { m_parallel = parallel; }
+    // number of the independent systems
+    size_t numBlocks() const { return m_blocks.size(); }
+
+    // func is the residual, possibly wrapped, e.g. by the profiler
+    void solve (std::shared_ptr<NonlinearFunction> func, VectorView<double> k) override
+    {
+      if (func->dimX() != m_s*m_n)
+        throw std::domain_error("ButcherNewton: function does not fit the stage system");
+      m_stats = Stats();
+      m_stats.solves = 1;
+      if (m_residual->tau() != m_tau) m_valid = false;
+
+      bool reused = m_valid;
+      m_kstart = k;
+      bool converged = iterate(*func, k);
+      if (!converged && reused && m_stats.factorizations == 0)
+        {
+          k = m_kstart;
+          m_valid = false;
+          converged = iterate(*func, k);
+        }
+
+      m_total.add(m_stats);
+      if (!converged)
+        throw std::domain_error("ButcherNewton did not converge, residual " + std::to_string(m_stats.residual)
+                                + " after " + std::to_string(m_stats.iterations) + " iterations and "
+                                + std::to_string(m_stats.factorizations) + " factorizations");
+    }
+  };
+
+
 
   class ImplicitRungeKutta : public TimeStepper
   {
     Matrix<> m_a;
     Vector<> m_b, m_c;
-    std::shared_ptr<NonlinearFunction> m_equ;
-    std::shared_ptr<Parameter> m_tau;
-    std::shared_ptr<ConstantFunction> m_yold;
+    std::shared_ptr<IRKResidual> m_residual;
     int m_stages;
     int m_n;
-    Vector<> m_k, m_y;
+    Vector<> m_k;
+
+    // stages of the last step, for the predictor
+    bool m_predict;
+    bool m_history = false;
+    Vector<> m_kold, m_ylast;
+    double m_tauold = 0;
+
+    bool isLastResult (VectorView<double> y) const
+    {
+      for (size_t i = 0; i < y.size(); i++)
+        if (y(i) != m_ylast(i)) return false;
+      return true;
+    }
+
+    // The derivative of the collocation polynomial of the last step
+    // interpolates its k_j at the nodes c_j. Extrapolated to the new stage
+    // times, theta = 1 + c_i tau/tauold in units of the old step.
+    void predict (double tau)
+    {
+      for (int i = 0; i < m_stages; i++)
+        {
+          auto ki = m_k.range(i*m_n, (i+1)*m_n);
+          ki = 0.0;
+          double theta = 1 + m_c(i) * tau / m_tauold;
+          for (int j = 0; j < m_stages; j++)
+            {
+              double lagrange = 1;
+              for (int l = 0; l < m_stages; l++)
+                if (l != j)
+                  lagrange *= (theta - m_c(l)) / (m_c(j) - m_c(l));
+              ki += lagrange * m_kold.range(j*m_n, (j+1)*m_n);
+            }
+        }
+    }
   public:
     ImplicitRungeKutta(std::shared_ptr<NonlinearFunction> rhs,
       const Matrix<> &a, const Vector<> &b, const Vector<> &c) 
     : TimeStepper(rhs), m_a(a), m_b(b), m_c(c),
-    m_tau(std::make_shared<Parameter>(0.0)),
-    m_stages(c.size()), m_n(rhs->dimX()), m_k(m_stages*m_n), m_y(m_stages*m_n)
+    m_stages(c.size()), m_n(rhs->dimX()), m_k(m_stages*m_n),
+    m_kold(m_stages*m_n), m_ylast(m_n)
     {
-      auto multiple_rhs = make_shared<MultipleFunc>(rhs, m_stages);
-      m_yold = std::make_shared<ConstantFunction>(m_stages*m_n);
-      auto knew = std::make_shared<IdentityFunction>(m_stages*m_n);
-      m_equ = knew - Compose(multiple_rhs, m_yold+m_tau*std::make_shared<MatVecFunc>(a, m_n));
+      // collocation methods, with distinct nodes
+      m_predict = true;
+      for (int i = 0; i < m_stages; i++)
+        for (int j = 0; j < i; j++)
+          if (m_c(i) == m_c(j)) m_predict = false;
+
+      m_solver = std::make_shared<Newton>(m_stages*m_n);
+      m_equ = Profiler::global().instrument(std::make_shared<IRKResidual>(rhs, a, c),
+                                            "ImplicitRungeKutta");
+      // instrumenting rebuilds the residual, the step has to set the one in m_equ
+      auto prof = std::dynamic_pointer_cast<ProfiledFunction>(m_equ);
+      m_residual = std::dynamic_pointer_cast<IRKResidual>(prof ? prof->function() : m_equ);
     }
 
-    void DoStep(double tau, VectorView<double> y) override
+    // the unknowns are the stage derivatives k, an error dk changes y by
+    // about tau dk: atol is scaled by 1/tau, rtol refers to |k| instead of |y|
+    void setTolerances (double rtol, double atol, double kappa = 0.1) override
     {
-      for (int j = 0; j < m_stages; j++)
-        m_y.range(j*m_n, (j+1)*m_n) = y;
-      m_yold->set(m_y);
+      m_rtol = rtol;
+      m_atol = atol;
+      m_kappa = kappa;
+      m_tolerances = true;
+    }
+
+    // Newton with the true Jacobian of the stage equations instead of the
+    // Kronecker form with J at y, see IRKResidual. ButcherNewton keeps the latter.
+    void setExactJacobian (bool exact)
+    {
+      m_residual->setExactJacobian(exact);
+      m_solver->invalidate();
+    }
 
-      m_tau->set(tau);
-      m_k = 0.0;  
-      NewtonSolver(m_equ, m_k);
+    // solve the stages with ButcherNewton on the residual of this stepper
+    std::shared_ptr<ButcherNewton> useButcherTransform (bool parallel = true)
+    {
+      auto solver = std::make_shared<ButcherNewton>(m_residual);
+      solver->setParallel(parallel);
+      setSolver(solver);
+      return solver;
+    }
+
+    // start Newton from the extrapolated collocation polynomial of the last
+    // step instead of k = 0. Used only if the step continues the last one.
+    void setPredictor (bool predict) { m_predict = predict; }
+
+    using TimeStepper::DoStep;
+    void DoStep(double t, double tau, VectorView<double> y) override
+    {
+      if (tau != m_residual->tau())
+        m_solver->invalidate();
+      m_residual->setStep(t, tau, y);
+      if (m_tolerances)
+        m_solver->setTolerances(m_rtol, m_atol / tau, m_kappa);
+
+      bool predicted = m_predict && m_history && t == m_t && isLastResult(y);
+      if (predicted)
+        predict(tau);
+      else
+        m_k = 0.0;
+      try
+        {
+          m_solver->solve(m_equ, m_k);
+        }
+      catch (std::domain_error &)
+        {
+          // rejected, the caller may retry with a smaller step
+          m_history = false;
+          if (!predicted) throw;
+          m_k = 0.0;
+          m_solver->solve(m_equ, m_k);
+        }
 
       for (int j = 0; j < m_stages; j++)
         y += tau * m_b(j) * m_k.range(j*m_n, (j+1)*m_n);
+      m_t = t + tau;
+      m_kold = m_k;
+      m_tauold = tau;
+      m_ylast = y;
+      m_history = true;
     }
   };
 
@@ -0,0 +1,492 @@
+#ifndef KRYLOV_HPP
+#define KRYLOV_HPP
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "Newton.hpp"
+#include "sparsematrix.hpp"
+
+namespace ASC_ode
+{
+
+  // approximate inverse M^{-1} of the Jacobian, for the right preconditioned GMRES
+  class Preconditioner
+  {
+  public:
+    virtual ~Preconditioner() = default;
+    // a new function, drop everything derived from the previous one's pattern
+    virtual void analyze (const NonlinearFunction & func) { }
+    // build from the Jacobian of func at x
+    virtual void setup (const NonlinearFunction & func, VectorView<double> x) = 0;
+    // z = M^{-1} r
+    virtual void apply (VectorView<double> r, VectorView<double> z) const = 0;
+  };
+
+
+  /*
+    Base for preconditioners built from the sparse Jacobian. ASSEMBLE
+    calls the sparse evaluateDeriv, which for functions without an override
+    goes through the dense Jacobian, and without pattern() the matrix is
+    dense as well. PROBE (Jacobi, BlockJacobi) computes the diagonal blocks
+    from products J v of applyDeriv only: block columns that do not couple
+    in the pattern share one product, for local coupling such as a chain a
+    few products per block column.
+  */
+  class SparsePreconditioner : public Preconditioner
+  {
+  public:
+    enum SETUP { ASSEMBLE, PROBE };
+
+  protected:
+    std::unique_ptr<SparseMatrix> m_jac;
+    SETUP m_setup;
+    std::vector<std::vector<size_t>> m_colors;   // blocks probed together
+    size_t m_colored = 0;                         // size of the coloring
+    Workspace m_ws;
+
+    SparsePreconditioner (SETUP setup) : m_setup(setup) { }
+
+  public:
+    void analyze (const NonlinearFunction & func) override
+    {
+      m_jac.reset();
+      m_colored = 0;
+    }
+
+  protected:
+
+    // the pattern of func with the diagonal added, built on first use
+    SparseMatrix & jacobian (const NonlinearFunction & func, VectorView<double> x)
+    {
+      size_t n = func.dimX();
+      if (!m_jac || m_jac->height() != n)
+        m_jac = std::make_unique<SparseMatrix>(MergePatterns(func.pattern(), DiagonalPattern(n, 0, n)), n);
+      func.evaluateDeriv(x, *m_jac);
+      return *m_jac;
+    }
+
+    // greedy coloring of the blocks of size bs, neighbours in the pattern differ
+    void colorBlocks (const NonlinearFunction & func, size_t bs)
+    {
+      size_t nb = func.dimX() / bs;
+      auto pattern = func.pattern();
+      std::vector<std::vector<size_t>> adj(nb);
+      for (size_t i = 0; i < pattern.size(); i++)
+        for (size_t j : pattern[i])
+          if (i/bs != j/bs)
+            {
+              adj[i/bs].push_back(j/bs);
+              adj[j/bs].push_back(i/bs);
+            }
+      std::vector<size_t> color(nb), mark;
+      m_colors.clear();
+      for (size_t b = 0; b < nb; b++)
+        {
+          mark.assign(m_colors.size()+1, nb);
+          for (size_t nbr : adj[b])
+            if (nbr < b) mark[color[nbr]] = b;
+          size_t c = 0;
+          while (mark[c] == b) c++;
+          if (c == m_colors.size()) m_colors.emplace_back();
+          color[b] = c;
+          m_colors[c].push_back(b);
+        }
+    }
+
+    // diagonal blocks of the Jacobian, blocks[(b*bs+i)*bs+j] = J(b*bs+i, b*bs+j)
+    void diagonalBlocks (const NonlinearFunction & func, VectorView<double> x, size_t bs,
+                         std::vector<double> & blocks)
+    {
+      size_t n = func.dimX();
+      blocks.resize(n*bs);
+      if (m_setup == ASSEMBLE)
+        {
+          auto & jac = jacobian(func, x);
+          for (size_t b = 0; b < n/bs; b++)
+            for (size_t i = 0; i < bs; i++)
+              for (size_t j = 0; j < bs; j++)
+                blocks[(b*bs+i)*bs+j] = jac(b*bs+i, b*bs+j);
+          return;
+        }
+
+      if (m_colored != n)
+        {
+          colorBlocks(func, bs);
+          m_colored = n;
+        }
+      auto v = m_ws.vec(0, n);
+      auto jv = m_ws.vec(1, n);
+      for (auto & group : m_colors)
+        for (size_t j = 0; j < bs; j++)
+          {
+            v = 0.0;
+            for (size_t b : group)
+              v(b*bs+j) = 1;
+            func.applyDeriv(x, v, jv);
+            for (size_t b : group)
+              for (size_t i = 0; i < bs; i++)
+                blocks[(b*bs+i)*bs+j] = jv(b*bs+i);
+          }
+    }
+  };
+
+
+  class JacobiPreconditioner : public SparsePreconditioner
+  {
+    std::vector<double> m_invdiag;
+  public:
+    JacobiPreconditioner (SETUP setup = ASSEMBLE) : SparsePreconditioner(setup) { }
+
+    void setup (const NonlinearFunction & func, VectorView<double> x) override
+    {
+      diagonalBlocks(func, x, 1, m_invdiag);
+      for (double & d : m_invdiag)
+        {
+          if (d == 0)
+            throw std::domain_error("JacobiPreconditioner: zero on the diagonal");
+          d = 1 / d;
+        }
+    }
+
+    void apply (VectorView<double> r, VectorView<double> z) const override
+    {
+      for (size_t i = 0; i < m_invdiag.size(); i++)
+        z(i) = m_invdiag[i] * r(i);
+    }
+  };
+
+
+  // inverts the diagonal blocks of size bs, e.g. the D x D blocks of one
+  // mass of MSS_Function<D>
+  class BlockJacobiPreconditioner : public SparsePreconditioner
+  {
+    size_t m_bs;
+    std::vector<LU<>> m_blocks;
+    std::vector<double> m_values;
+  public:
+    BlockJacobiPreconditioner (size_t bs, SETUP setup = ASSEMBLE)
+      : SparsePreconditioner(setup), m_bs(bs) { }
+
+    void setup (const NonlinearFunction & func, VectorView<double> x) override
+    {
+      size_t n = func.dimX();
+      if (n % m_bs != 0)
+        throw std::domain_error("BlockJacobiPreconditioner: size is not a multiple of the block size");
+
+      if (m_blocks.size() != n / m_bs)
+        {
+          m_blocks.clear();
+          for (size_t b = 0; b < n / m_bs; b++)
+            m_blocks.emplace_back(m_bs);
+        }
+
+      diagonalBlocks(func, x, m_bs, m_values);
+      Matrix<> block(m_bs, m_bs);
+      for (size_t b = 0; b < m_blocks.size(); b++)
+        {
+          for (size_t i = 0; i < m_bs; i++)
+            for (size_t j = 0; j < m_bs; j++)
+              block(i,j) = m_values[(b*m_bs+i)*m_bs+j];
+          m_blocks[b].factor(block);
+        }
+    }
+
+    void apply (VectorView<double> r, VectorView<double> z) const override
+    {
+      z = r;
+      for (size_t b = 0; b < m_blocks.size(); b++)
+        m_blocks[b].solve(z.range(b*m_bs, (b+1)*m_bs));
+    }
+  };
+
+
+  // incomplete LU factorization without fill-in, on the pattern of the Jacobian
+  class ILU0Preconditioner : public SparsePreconditioner
+  {
+    std::vector<size_t> m_diagpos;
+    std::vector<size_t> m_pos;     // column -> position in the current row
+  public:
+    ILU0Preconditioner () : SparsePreconditioner(ASSEMBLE) { }
+
+    void setup (const NonlinearFunction & func, VectorView<double> x) override
+    {
+      auto & a = jacobian(func, x);
+      size_t n = a.height();
+      size_t none = a.nze();
+      m_diagpos.resize(n);
+      m_pos.assign(n, none);
+      for (size_t i = 0; i < n; i++)
+        m_diagpos[i] = a.position(i, i);
+
+      for (size_t i = 0; i < n; i++)
+        {
+          for (size_t k = a.firstInRow(i); k < a.firstInRow(i+1); k++)
+            m_pos[a.colNr(k)] = k;
+
+          for (size_t k = a.firstInRow(i); k < m_diagpos[i]; k++)
+            {
+              size_t col = a.colNr(k);
+              double l = (a.value(k) /= a.value(m_diagpos[col]));
+              for (size_t kk = m_diagpos[col]+1; kk < a.firstInRow(col+1); kk++)
+                if (m_pos[a.colNr(kk)] != none)
+                  a.value(m_pos[a.colNr(kk)]) -= l * a.value(kk);
+            }
+          if (a.value(m_diagpos[i]) == 0)
+            throw std::domain_error("ILU0Preconditioner: zero pivot");
+
+          for (size_t k = a.firstInRow(i); k < a.firstInRow(i+1); k++)
+            m_pos[a.colNr(k)] = none;
+        }
+    }
+
+    void apply (VectorView<double> r, VectorView<double> z) const override
+    {
+      auto & a = *m_jac;
+      size_t n = a.height();
+      for (size_t i = 0; i < n; i++)
+        {
+          double sum = r(i);
+          for (size_t k = a.firstInRow(i); k < m_diagpos[i]; k++)
+            sum -= a.value(k) * z(a.colNr(k));
+          z(i) = sum;
+        }
+      for (size_t i = n; i-- > 0; )
+        {
+          double sum = z(i);
+          for (size_t k = m_diagpos[i]+1; k < a.firstInRow(i+1); k++)
+            sum -= a.value(k) * z(a.colNr(k));
+          z(i) = sum / a.value(m_diagpos[i]);
+        }
+    }
+  };
+
+
+  /*
+    Jacobian-free Newton-Krylov: the Newton updates are solved inexactly by
+    restarted GMRES, which needs only the products J v of applyDeriv, so
+    neither the dense Jacobian nor a factorization is ever formed. The
+    relative accuracy of the linear solves follows the Eisenstat-Walker
+    forcing terms, loose far from the solution and tight close to it.
+    The preconditioner is set up on the first iteration and kept, like the
+    factorization of Newton, until invalidate(), a different function, or
+    a linear solve that needed more than half the restart length.
+  */
+  class NewtonKrylov : public NonlinearSolver
+  {
+    std::shared_ptr<Preconditioner> m_pre;
+    double m_tol;
+    int m_maxsteps;
+    size_t m_restart = 30;
+    size_t m_maxlinear = 300;
+    double m_etamax = 0.9;
+    bool m_valid = false;
+    std::weak_ptr<NonlinearFunction> m_analyzed;   // function the preconditioner was built for
+    Workspace m_ws;
+
+    static double Dot (VectorView<double> a, VectorView<double> b)
+    {
+      double sum = 0;
+      for (size_t i = 0; i < a.size(); i++)
+        sum += a(i) * b(i);
+      return sum;
+    }
+
+    void precondition (VectorView<double> r, VectorView<double> z) const
+    {
+      if (m_pre)
+        m_pre->apply(r, z);
+      else
+        z = r;
+    }
+
+    // J d = b up to |b - J d| <= tol, returns the number of iterations
+    size_t gmres (const NonlinearFunction & func, VectorView<double> x,
+                  VectorView<double> b, VectorView<double> d, double tol)
+    {
+      size_t n = b.size(), m = m_restart;
+      auto r = m_ws.vec(2, n);
+      auto w = m_ws.vec(3, n);
+      auto z = m_ws.vec(4, n);
+      auto V = m_ws.mat(5, m+1, n);
+      auto H = m_ws.mat(6, m+1, m);
+      auto cs = m_ws.vec(7, m);
+      auto sn = m_ws.vec(8, m);
+      auto g = m_ws.vec(9, m+1);
+      auto y = m_ws.vec(10, m);
+
+      d = 0.0;
+      r = b;
+      size_t its = 0;
+      while (its < m_maxlinear)
+        {
+          double beta = norm(r);
+          if (beta <= tol) break;
+          V.row(0) = (1/beta) * r;
+          g = 0.0;
+          g(0) = beta;
+
+          size_t k = 0;
+          bool done = false;
+          for (size_t j = 0; j < m && its < m_maxlinear; j++)
+            {
+              // Arnoldi with modified Gram-Schmidt
+              precondition(V.row(j), z);
+              func.applyDeriv(x, z, w);
+              for (size_t i = 0; i <= j; i++)
+                {
+                  H(i,j) = Dot(w, V.row(i));
+                  w -= H(i,j) * V.row(i);
+                }
+              double h = norm(w);
+              H(j+1,j) = h;
+              if (h > 0)
+                V.row(j+1) = (1/h) * w;
+
+              // least squares problem by Givens rotations
+              for (size_t i = 0; i < j; i++)
+                {
+                  double tmp = cs(i)*H(i,j) + sn(i)*H(i+1,j);
+                  H(i+1,j) = -sn(i)*H(i,j) + cs(i)*H(i+1,j);
+                  H(i,j) = tmp;
+                }
+              double denom = std::hypot(H(j,j), H(j+1,j));
+              if (denom == 0)
+                throw std::domain_error("GMRES: breakdown, singular Jacobian");
+              cs(j) = H(j,j) / denom;
+              sn(j) = H(j+1,j) / denom;
+              H(j,j) = denom;
+              H(j+1,j) = 0;
+              g(j+1) = -sn(j) * g(j);
+              g(j) *= cs(j);
+
+              its++;
+              k = j+1;
+              if (std::abs(g(j+1)) <= tol || h == 0)
+                {
+                  done = true;
+                  break;
+                }
+            }
+
+          // d += M^{-1} V y  with  H y = g
+          for (size_t i = k; i-- > 0; )
+            {
+              double sum = g(i);
+              for (size_t l = i+1; l < k; l++)
+                sum -= H(i,l) * y(l);
+              y(i) = sum / H(i,i);
+            }
+          w = 0.0;
+          for (size_t i = 0; i < k; i++)
+            w += y(i) * V.row(i);
+          precondition(w, z);
+          d += z;
+          if (done) break;
+
+          func.applyDeriv(x, d, w);
+          r = b - w;
+        }
+      return its;
+    }
+
+  public:
+    NewtonKrylov (std::shared_ptr<Preconditioner> pre = nullptr,
+                  double tol = 1e-10, int maxsteps = 50)
+      : m_pre(pre), m_tol(tol), m_maxsteps(maxsteps) { }
+
+    void invalidate() override { m_valid = false; }
+    void setTolerance (double tol) { m_tol = tol; }
+    void setMaxSteps (int maxsteps) { m_maxsteps = maxsteps; }
+    // Krylov dimension before GMRES restarts, and GMRES iterations per update
+    void setRestart (size_t restart) { m_restart = restart; }
+    void setMaxLinearIterations (size_t maxlinear) { m_maxlinear = maxlinear; }
+
+    void solve (std::shared_ptr<NonlinearFunction> func, VectorView<double> x) override
+    {
+      m_stats = Stats();
+      m_stats.solves = 1;
+      size_t n = func->dimX();
+      auto res = m_ws.vec(0, n);
+      auto d = m_ws.vec(1, n);
+
+      if (m_analyzed.lock() != func)
+        {
+          if (m_pre) m_pre->analyze(*func);
+          m_analyzed = func;
+          m_valid = false;
+        }
+
+      // Eisenstat-Walker, choice 2, gamma = 0.9, alpha = 2
+      const double gamma = 0.9;
+      double eta = 0.5;
+      double resold = 0, dxold = -1;
+      bool converged = false;
+      for (int i = 0; i < m_maxsteps; i++)
+        {
+          auto start = std::chrono::steady_clock::now();
+          func->evaluate(x, res);
+          m_stats.timeEvaluate += Since(start);
+          m_stats.residual = norm(res);
+          if (m_stats.residual < m_tol)
+            {
+              converged = true;
+              break;
+            }
+
+          if (i > 0)
+            {
+              double ratio = m_stats.residual / resold;
+              m_stats.rate = std::max(m_stats.rate, ratio);
+              double etanew = gamma * ratio * ratio;
+              if (gamma * eta * eta > 0.1)
+                etanew = std::max(etanew, gamma * eta * eta);
+              eta = std::min(etanew, m_etamax);
+            }
+          // no oversolving at the last step
+          eta = std::min(m_etamax, std::max(eta, 0.5 * m_tol / m_stats.residual));
+          resold = m_stats.residual;
+
+          if (!m_valid && m_pre)
+            {
+              start = std::chrono::steady_clock::now();
+              m_pre->setup(*func, x);
+              m_stats.timeDeriv += Since(start);
+              m_stats.factorizations++;
+            }
+          m_valid = true;
+
+          start = std::chrono::steady_clock::now();
+          size_t its = gmres(*func, x, res, d, eta * m_stats.residual);
+          m_stats.timeSolve += Since(start);
+          m_stats.linearIterations += its;
+          if (its > m_restart/2)
+            m_valid = false;
+
+          x -= d;
+          m_stats.iterations++;
+
+          if (weighted())
+            {
+              double dx = weightedNorm(d, x);
+              if (closeEnough(dx, dxold))
+                {
+                  converged = true;
+                  break;
+                }
+              dxold = dx;
+            }
+        }
+
+      m_total.add(m_stats);
+      if (!converged)
+        throw std::domain_error("NewtonKrylov did not converge, residual " + std::to_string(m_stats.residual)
+                                + " after " + std::to_string(m_stats.iterations) + " iterations and "
+                                + std::to_string(m_stats.linearIterations) + " GMRES iterations");
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef LU_HPP
+#define LU_HPP
+
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+#ifdef ASC_ODE_USE_LAPACK
+extern "C"
+{
+  void dgetrf_ (int * m, int * n, double * a, int * lda, int * ipiv, int * info);
+  void dgetrs_ (char * trans, int * n, int * nrhs, double * a, int * lda,
+                int * ipiv, double * b, int * ldb, int * info);
+}
+#endif
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  /*
+    LU factorization with partial pivoting, P A = L U. Factorizing costs n^3/3
+    multiplications, one solve n^2, so a factorization kept over several
+    solves is much cheaper than the explicit inverse. Zero multipliers skip
+    their row update, which keeps banded and block matrices cheap.
+    With ASC_ODE_USE_LAPACK, LU<double> factorizes with LAPACK dgetrf
+    instead, in the same buffers, and also throws for a singular matrix.
+  */
+  template <typename T = double>
+  class LU
+  {
+    Matrix<T> m_lu;               // L below the diagonal (unit diagonal), U on and above
+    std::vector<size_t> m_perm;   // row i of L U is row m_perm[i] of A
+    mutable Vector<T> m_y;
+#ifdef ASC_ODE_USE_LAPACK
+    std::vector<int> m_ipiv;      // pivots of dgetrf, m_lu holds the factors column major
+  public:
+    LU (size_t n) : m_lu(n, n), m_perm(n), m_y(n), m_ipiv(n) { }
+#else
+  public:
+    LU (size_t n) : m_lu(n, n), m_perm(n), m_y(n) { }
+#endif
+
+    size_t size() const { return m_perm.size(); }
+
+    template <typename TM>
+    void factor (const TM & a)
+    {
+#ifdef ASC_ODE_USE_LAPACK
+      if constexpr (std::is_same_v<T,double>)
+        {
+          int n = size(), info = 0;
+          for (int i = 0; i < n; i++)
+            for (int j = 0; j < n; j++)
+              m_lu(j,i) = a(i,j);
+          if (n > 0)
+            dgetrf_(&n, &n, m_lu.data(), &n, m_ipiv.data(), &info);
+          if (info != 0)
+            throw std::domain_error("LU: matrix is singular, LAPACK info = " + std::to_string(info));
+          return;
+        }
+#endif
+      size_t n = size();
+      for (size_t i = 0; i < n; i++)
+        {
+          m_perm[i] = i;
+          for (size_t j = 0; j < n; j++)
+            m_lu(i,j) = a(i,j);
+        }
+
+      for (size_t k = 0; k < n; k++)
+        {
+          size_t p = k;
+          for (size_t i = k+1; i < n; i++)
+            if (std::abs(m_lu(i,k)) > std::abs(m_lu(p,k)))
+              p = i;
+          if (m_lu(p,k) == T(0))
+            throw std::domain_error("LU: matrix is singular");
+          if (p != k)
+            {
+              for (size_t j = 0; j < n; j++)
+                std::swap(m_lu(k,j), m_lu(p,j));
+              std::swap(m_perm[k], m_perm[p]);
+            }
+
+          T inv = T(1) / m_lu(k,k);
+          for (size_t i = k+1; i < n; i++)
+            {
+              T l = (m_lu(i,k) *= inv);
+              if (l != T(0))
+                for (size_t j = k+1; j < n; j++)
+                  m_lu(i,j) -= l * m_lu(k,j);
+            }
+        }
+    }
+
+    // b <- A^{-1} b
+    void solve (VectorView<T> b) const
+    {
+#ifdef ASC_ODE_USE_LAPACK
+      if constexpr (std::is_same_v<T,double>)
+        {
+          int n = size(), nrhs = 1, info = 0;
+          char trans = 'N';
+          if (n == 0) return;
+          for (int i = 0; i < n; i++)
+            m_y(i) = b(i);
+          dgetrs_(&trans, &n, &nrhs, const_cast<double*>(m_lu.data()), &n,
+                  const_cast<int*>(m_ipiv.data()), m_y.data(), &n, &info);
+          for (int i = 0; i < n; i++)
+            b(i) = m_y(i);
+          return;
+        }
+#endif
+      size_t n = size();
+      for (size_t i = 0; i < n; i++)
+        {
+          T sum = b(m_perm[i]);
+          for (size_t j = 0; j < i; j++)
+            sum -= m_lu(i,j) * m_y(j);
+          m_y(i) = sum;
+        }
+      for (size_t i = n; i-- > 0; )
+        {
+          T sum = m_y(i);
+          for (size_t j = i+1; j < n; j++)
+            sum -= m_lu(i,j) * b(j);
+          b(i) = sum / m_lu(i,i);
+        }
+    }
+  };
+
+}
+
+#endif
@@ -4,14 +4,53 @@
 #include <memory>
 #include <cstddef>
 #include <memory>
+#include <vector>
 
 #include <vector.hpp>
 #include <matrix.hpp>
 
+#include "sparsematrix.hpp"
+
 namespace ASC_ode
 {
   using namespace nanoblas;
 
+  class NonlinearFunction;
+
+  // Scratch memory of one node in the function tree. Buffers are
+  // allocated on first use and reused afterwards, so evaluate and
+  // evaluateDeriv of the combinators do not allocate inside Newton.
+  class Workspace
+  {
+    mutable std::vector<std::vector<double>> m_buffers;
+    mutable std::vector<std::unique_ptr<SparseMatrix>> m_sparse;
+
+    double * get (size_t nr, size_t size) const
+    {
+      if (m_buffers.size() <= nr)
+        m_buffers.resize(nr+1);
+      if (m_buffers[nr].size() < size)
+        m_buffers[nr].resize(size);
+      return m_buffers[nr].data();
+    }
+  public:
+    Workspace () = default;
+    // scratch is not part of the state, a copy starts empty
+    Workspace (const Workspace &) { }
+    Workspace & operator= (const Workspace &) { return *this; }
+
+    VectorView<double> vec (size_t nr, size_t n) const
+    {
+      return VectorView<double>(n, get(nr, n));
+    }
+    MatrixView<double> mat (size_t nr, size_t h, size_t w) const
+    {
+      return MatrixView<double>(h, w, w, get(nr, h*w));
+    }
+    // sparse matrix with the Jacobian pattern of func, built on first use
+    SparseMatrix & sparse (size_t nr, const NonlinearFunction & func) const;
+  };
+
   class NonlinearFunction
   {
   public:
@@ -20,6 +59,178 @@ namespace ASC_ode
     virtual size_t dimF() const = 0;
     virtual void evaluate (VectorView<double> x, VectorView<double> f) const = 0;
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const = 0;
+
+    // f and df at the same x, overridden where both share work
+    virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                                    MatrixView<double> df) const
+    {
+      evaluate(x, f);
+      evaluateDeriv(x, df);
+    }
+
+    // f.col(j) = func(x.col(j)) for a batch of states, one state per column.
+    // Matrix rows are contiguous over the batch, so overrides can vectorize
+    // over it. The default loops over the columns.
+    virtual void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const
+    {
+      auto xj = m_fallback.vec(1, dimX());
+      auto fj = m_fallback.vec(2, dimF());
+      for (size_t j = 0; j < x.cols(); j++)
+        {
+          xj = x.col(j);
+          evaluate(xj, fj);
+          f.col(j) = fj;
+        }
+    }
+
+    // Jv = df(x) * v without forming the Jacobian.
+    // The default is a directional finite difference.
+    virtual void applyDeriv (VectorView<double> x, VectorView<double> v,
+                             VectorView<double> Jv) const
+    {
+      double nv = norm(v);
+      if (nv == 0.0)
+        {
+          Jv = 0.0;
+          return;
+        }
+      double eps = 1e-8 * (1+norm(x)) / nv;
+      auto xeps = m_fallback.vec(3, dimX());
+      auto fx = m_fallback.vec(4, dimF());
+      xeps = x + eps*v;
+      evaluate(xeps, Jv);
+      evaluate(x, fx);
+      Jv -= fx;
+      Jv *= 1/eps;
+    }
+
+    // JTw = df(x)^T * w. The default goes through the dense evaluateDeriv.
+    virtual void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                                      VectorView<double> JTw) const
+    {
+      auto dense = m_fallback.mat(0, dimF(), dimX());
+      evaluateDeriv(x, dense);
+      JTw = 0.0;
+      for (size_t i = 0; i < dimF(); i++)
+        for (size_t j = 0; j < dimX(); j++)
+          JTw(j) += dense(i,j) * w(i);
+    }
+
+    // sparsity pattern of the Jacobian, dense unless overridden
+    virtual SparsityPattern pattern() const { return DensePattern(dimF(), dimX()); }
+
+    // Jacobian into df, whose pattern must contain pattern().
+    // The default goes through the dense evaluateDeriv.
+    virtual void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const
+    {
+      auto dense = m_fallback.mat(0, dimF(), dimX());
+      evaluateDeriv(x, dense);
+      df = 0.0;
+      for (size_t i = 0; i < df.height(); i++)
+        for (size_t k = df.firstInRow(i); k < df.firstInRow(i+1); k++)
+          df.value(k) = dense(i, df.colNr(k));
+    }
+
+    // direct subfunctions, for passes over the function tree
+    virtual std::vector<std::shared_ptr<NonlinearFunction>> children() const { return { }; }
+    // a new node like this one, with the children funcs. Passes over the tree
+    // rebuild nodes instead of changing the ones the caller may still hold.
+    // nullptr if the node cannot be rebuilt, the passes keep it as it is.
+    virtual std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const { return nullptr; }
+
+    // time of the TimeDependentFunctions in the tree. Combinators forward
+    // it to their children without the children() vector.
+    virtual void setTime (double t)
+    {
+      for (auto & child : children())
+        child->setTime(t);
+    }
+    // true if a TimeDependentFunction is in the tree
+    virtual bool isTimeDependent() const
+    {
+      for (auto & child : children())
+        if (child->isTimeDependent()) return true;
+      return false;
+    }
+
+    // true if f(x) does not depend on x. Nodes with children are
+    // invariant if all their children are.
+    virtual bool isInvariant() const
+    {
+      auto funcs = children();
+      if (funcs.empty()) return false;
+      for (auto & child : funcs)
+        if (!child->isInvariant()) return false;
+      return true;
+    }
+
+    // f(x) = A x (LINEAR) or A x + b (AFFINE): the Jacobian does not depend on x,
+    // and the time steppers assume it does not change between steps either,
+    // except through their own parameters. Ordered, so that std::max combines.
+    enum LINEARITY { LINEAR, AFFINE, NONLINEAR };
+    virtual LINEARITY linearity() const { return isInvariant() ? AFFINE : NONLINEAR; }
+  private:
+    Workspace m_fallback;
+  };
+
+
+  inline SparseMatrix & Workspace :: sparse (size_t nr, const NonlinearFunction & func) const
+  {
+    if (m_sparse.size() <= nr)
+      m_sparse.resize(nr+1);
+    if (!m_sparse[nr])
+      m_sparse[nr] = std::make_unique<SparseMatrix>(func.pattern(), func.dimX());
+    return *m_sparse[nr];
+  }
+
+
+  // func with its children replaced by pass(child): a rebuilt node if a
+  // child changes, otherwise func itself
+  template <typename PASS>
+  std::shared_ptr<NonlinearFunction> RebuildChildren (std::shared_ptr<NonlinearFunction> func, PASS && pass)
+  {
+    auto children = func->children();
+    bool changed = false;
+    for (auto & child : children)
+      {
+        auto newchild = pass(child);
+        changed |= (newchild != child);
+        child = newchild;
+      }
+    if (!changed) return func;
+    auto rebuilt = func->withChildren(children);
+    return rebuilt ? rebuilt : func;
+  }
+
+
+  /*
+    Right hand side f(t,x) of a non-autonomous ODE, derivatives are with
+    respect to x. In a function tree it evaluates at the time last set by
+    setTime, which the time steppers do before they evaluate or solve.
+    setTime on any node above reaches it.
+    The linearity traits refer to x, AFFINE or LINEAR also promise a
+    Jacobian that does not change with t.
+  */
+  class TimeDependentFunction : public NonlinearFunction
+  {
+    double m_t = 0;
+  public:
+    virtual void evaluate (double t, VectorView<double> x, VectorView<double> f) const = 0;
+    virtual void evaluateDeriv (double t, VectorView<double> x, MatrixView<double> df) const = 0;
+
+    void setTime (double t) override { m_t = t; }
+    bool isTimeDependent() const override { return true; }
+    double time() const { return m_t; }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      evaluate(m_t, x, f);
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      evaluateDeriv(m_t, x, df);
+    }
   };
 
 
@@ -34,12 +245,35 @@ namespace ASC_ode
     {
       f = x;
     }
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      f = x;
+    }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      Jv = v;
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      JTw = w;
+    }
 
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
       df.diag() = 1.0;
     }
+
+    SparsityPattern pattern() const override { return DiagonalPattern(m_n, 0, m_n); }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 0.0;
+      for (size_t i = 0; i < m_n; i++)
+        df(i,i) = 1.0;
+    }
+    LINEARITY linearity() const override { return LINEAR; }
   };
 
 
@@ -47,21 +281,47 @@ namespace ASC_ode
   class ConstantFunction : public NonlinearFunction
   {
     Vector<> m_val;
+    size_t m_version = 0;
   public:
     ConstantFunction(size_t n) : m_val(n) { }
     ConstantFunction(VectorView<double> val) : m_val(val) { }
-    void set(VectorView<double> val) { m_val = val; }
-    VectorView<double> get() const { return m_val; }
+    void set(VectorView<double> val) { m_val = val; m_version++; }
+    // read only, changes go through set() for version()
+    const Vector<> & get() const { return m_val; }
+    // counts the calls of set(), InvariantFunction refreshes on a new version
+    size_t version() const { return m_version; }
+    bool isInvariant() const override { return true; }
     size_t dimX() const override { return m_val.size(); }
     size_t dimF() const override { return m_val.size(); }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
     {
       f = m_val;
     }
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      for (size_t i = 0; i < m_val.size(); i++)
+        f.row(i) = m_val(i);
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
     }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      Jv = 0.0;
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      JTw = 0.0;
+    }
+
+    SparsityPattern pattern() const override { return SparsityPattern(dimF()); }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 0.0;
+    }
   };
 
   
@@ -70,30 +330,93 @@ namespace ASC_ode
   {
     std::shared_ptr<NonlinearFunction> m_fa, m_fb;
     double m_faca, m_facb;
+    Workspace m_ws;
   public:
     SumFunction (std::shared_ptr<NonlinearFunction> fa,
                  std::shared_ptr<NonlinearFunction> fb,
                  double faca, double facb)
       : m_fa(fa), m_fb(fb), m_faca(faca), m_facb(facb) { }
 
+    double factorA() const { return m_faca; }
+    double factorB() const { return m_facb; }
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { m_fa, m_fb }; }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      return std::make_shared<SumFunction>(funcs[0], funcs[1], m_faca, m_facb);
+    }
+    void setTime (double t) override { m_fa->setTime(t); m_fb->setTime(t); }
+    LINEARITY linearity() const override { return std::max(m_fa->linearity(), m_fb->linearity()); }
+
     size_t dimX() const override { return m_fa->dimX(); }
     size_t dimF() const override { return m_fa->dimF(); }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
     {
       m_fa->evaluate(x, f);
       f *= m_faca;
-      Vector<> tmp(dimF());
+      auto tmp = m_ws.vec(0, dimF());
       m_fb->evaluate(x, tmp);
       f += m_facb*tmp;
     }
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      m_fa->evaluateBatch(x, f);
+      f *= m_faca;
+      auto tmp = m_ws.mat(2, dimF(), x.cols());
+      m_fb->evaluateBatch(x, tmp);
+      f += m_facb*tmp;
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       m_fa->evaluateDeriv(x, df);
       df *= m_faca;
-      Matrix<double> tmp(dimF(), dimX());
+      auto tmp = m_ws.mat(1, dimF(), dimX());
       m_fb->evaluateDeriv(x, tmp);
       df += m_facb*tmp;
     }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      m_fa->evaluateWithDeriv(x, f, df);
+      f *= m_faca;
+      df *= m_faca;
+      auto tmp = m_ws.vec(0, dimF());
+      auto dtmp = m_ws.mat(1, dimF(), dimX());
+      m_fb->evaluateWithDeriv(x, tmp, dtmp);
+      f += m_facb*tmp;
+      df += m_facb*dtmp;
+    }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      m_fa->applyDeriv(x, v, Jv);
+      Jv *= m_faca;
+      auto tmp = m_ws.vec(0, dimF());
+      m_fb->applyDeriv(x, v, tmp);
+      Jv += m_facb*tmp;
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      m_fa->applyDerivTranspose(x, w, JTw);
+      JTw *= m_faca;
+      auto tmp = m_ws.vec(3, dimX());
+      m_fb->applyDerivTranspose(x, w, tmp);
+      JTw += m_facb*tmp;
+    }
+
+    SparsityPattern pattern() const override
+    {
+      return MergePatterns(m_fa->pattern(), m_fb->pattern());
+    }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      m_fa->evaluateDeriv(x, df);
+      df *= m_faca;
+      auto & tmp = m_ws.sparse(0, *m_fb);
+      m_fb->evaluateDeriv(x, tmp);
+      df.addScaled(m_facb, tmp);
+    }
   };
 
 
@@ -125,6 +448,16 @@ namespace ASC_ode
                    std::shared_ptr<Parameter> fac)
       : m_fa(fa), m_fac(fac) { }
 
+    std::shared_ptr<Parameter> factor() const { return m_fac; }
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { m_fa }; }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      return std::make_shared<ScaleFunction>(funcs[0], m_fac);
+    }
+    void setTime (double t) override { m_fa->setTime(t); }
+    LINEARITY linearity() const override { return m_fa->linearity(); }
+
     size_t dimX() const override { return m_fa->dimX(); }
     size_t dimF() const override { return m_fa->dimF(); }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
@@ -132,12 +465,43 @@ namespace ASC_ode
       m_fa->evaluate(x, f);
       f *= m_fac->get();
    }
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      m_fa->evaluateBatch(x, f);
+      f *= m_fac->get();
+    }
 
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       m_fa->evaluateDeriv(x, df);
       df *= m_fac->get();
     }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      m_fa->evaluateWithDeriv(x, f, df);
+      f *= m_fac->get();
+      df *= m_fac->get();
+    }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      m_fa->applyDeriv(x, v, Jv);
+      Jv *= m_fac->get();
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      m_fa->applyDerivTranspose(x, w, JTw);
+      JTw *= m_fac->get();
+    }
+
+    SparsityPattern pattern() const override { return m_fa->pattern(); }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      m_fa->evaluateDeriv(x, df);
+      df *= m_fac->get();
+    }
   };
 
   inline auto operator* (std::shared_ptr<Parameter> parama, 
@@ -152,37 +516,366 @@ namespace ASC_ode
   } 
 
 
+  // sum_i c_i f_i(x), where c_i is a number times a product of Parameters.
+  // Invariant terms (e.g. ConstantFunction) do not enter the Jacobian,
+  // IdentityFunction terms become a shift of its diagonal.
+  class LinearCombinationFunction : public NonlinearFunction
+  {
+  public:
+    enum KIND { GENERAL, CONSTANT, IDENTITY };
+    struct Term
+    {
+      double fac;
+      std::vector<std::shared_ptr<Parameter>> params;
+      std::shared_ptr<NonlinearFunction> func;
+      KIND kind = GENERAL;
+
+      double factor() const
+      {
+        double val = fac;
+        for (auto & p : params)
+          val *= p->get();
+        return val;
+      }
+    };
+  private:
+    std::vector<Term> m_terms;
+    size_t m_dimx, m_dimf;
+    bool m_hasgeneral = false, m_hasidentity = false;
+    Workspace m_ws;
+
+    void classify()
+    {
+      m_hasgeneral = m_hasidentity = false;
+      for (auto & t : m_terms)
+        {
+          if (dynamic_cast<IdentityFunction*>(t.func.get()))
+            t.kind = IDENTITY;
+          else if (t.func->isInvariant())
+            t.kind = CONSTANT;
+          else
+            t.kind = GENERAL;
+          m_hasgeneral |= (t.kind == GENERAL);
+          m_hasidentity |= (t.kind == IDENTITY);
+        }
+    }
+
+    double shift() const
+    {
+      double sum = 0;
+      for (auto & t : m_terms)
+        if (t.kind == IDENTITY) sum += t.factor();
+      return sum;
+    }
+
+    // f = shift*x + constant terms
+    void evaluateLinear (VectorView<double> x, VectorView<double> f) const
+    {
+      if (m_hasidentity)
+        f = shift()*x;
+      else
+        f = 0.0;
+      auto tmp = m_ws.vec(0, m_dimf);
+      for (auto & t : m_terms)
+        if (t.kind == CONSTANT)
+          {
+            t.func->evaluate(x, tmp);
+            f += t.factor()*tmp;
+          }
+    }
+  public:
+    LinearCombinationFunction (std::vector<Term> terms)
+      : m_terms(terms), m_dimx(terms[0].func->dimX()), m_dimf(terms[0].func->dimF())
+    {
+      classify();
+    }
+
+    const std::vector<Term> & terms() const { return m_terms; }
 
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override
+    {
+      std::vector<std::shared_ptr<NonlinearFunction>> funcs;
+      for (auto & t : m_terms)
+        funcs.push_back(t.func);
+      return funcs;
+    }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      auto terms = m_terms;
+      for (size_t i = 0; i < terms.size(); i++)
+        terms[i].func = funcs[i];
+      return std::make_shared<LinearCombinationFunction>(terms);
+    }
+    void setTime (double t) override
+    {
+      for (auto & term : m_terms)
+        term.func->setTime(t);
+    }
+    LINEARITY linearity() const override
+    {
+      LINEARITY lin = LINEAR;
+      for (auto & t : m_terms)
+        lin = std::max(lin, t.func->linearity());
+      return lin;
+    }
+
+    size_t dimX() const override { return m_dimx; }
+    size_t dimF() const override { return m_dimf; }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      evaluateLinear(x, f);
+      auto tmp = m_ws.vec(0, m_dimf);
+      for (auto & t : m_terms)
+        if (t.kind == GENERAL)
+          {
+            t.func->evaluate(x, tmp);
+            f += t.factor()*tmp;
+          }
+    }
+
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      if (m_hasidentity)
+        {
+          f = x;
+          f *= shift();
+        }
+      else
+        f = 0.0;
+      auto tmp = m_ws.mat(2, m_dimf, x.cols());
+      for (auto & t : m_terms)
+        if (t.kind != IDENTITY)
+          {
+            t.func->evaluateBatch(x, tmp);
+            f += t.factor()*tmp;
+          }
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+      auto tmp = m_ws.mat(1, m_dimf, m_dimx);
+      for (auto & t : m_terms)
+        if (t.kind == GENERAL)
+          {
+            t.func->evaluateDeriv(x, tmp);
+            df += t.factor()*tmp;
+          }
+      if (m_hasidentity)
+        {
+          double diag = shift();
+          for (size_t i = 0; i < m_dimf; i++)
+            df(i,i) += diag;
+        }
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      evaluateLinear(x, f);
+      df = 0.0;
+      auto tmp = m_ws.vec(0, m_dimf);
+      auto dtmp = m_ws.mat(1, m_dimf, m_dimx);
+      for (auto & t : m_terms)
+        if (t.kind == GENERAL)
+          {
+            t.func->evaluateWithDeriv(x, tmp, dtmp);
+            double fac = t.factor();
+            f += fac*tmp;
+            df += fac*dtmp;
+          }
+      if (m_hasidentity)
+        {
+          double diag = shift();
+          for (size_t i = 0; i < m_dimf; i++)
+            df(i,i) += diag;
+        }
+    }
+
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      if (m_hasidentity)
+        Jv = shift()*v;
+      else
+        Jv = 0.0;
+      auto tmp = m_ws.vec(0, m_dimf);
+      for (auto & t : m_terms)
+        if (t.kind == GENERAL)
+          {
+            t.func->applyDeriv(x, v, tmp);
+            Jv += t.factor()*tmp;
+          }
+    }
+
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      if (m_hasidentity)
+        JTw = shift()*w;
+      else
+        JTw = 0.0;
+      auto tmp = m_ws.vec(3, m_dimx);
+      for (auto & t : m_terms)
+        if (t.kind == GENERAL)
+          {
+            t.func->applyDerivTranspose(x, w, tmp);
+            JTw += t.factor()*tmp;
+          }
+    }
+
+    SparsityPattern pattern() const override
+    {
+      SparsityPattern pattern(m_dimf);
+      if (m_hasidentity)
+        pattern = DiagonalPattern(m_dimf, 0, m_dimf);
+      for (auto & t : m_terms)
+        if (t.kind == GENERAL)
+          pattern = MergePatterns(pattern, t.func->pattern());
+      return pattern;
+    }
+
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 0.0;
+      for (size_t i = 0; i < m_terms.size(); i++)
+        if (m_terms[i].kind == GENERAL)
+          {
+            auto & tmp = m_ws.sparse(i, *m_terms[i].func);
+            m_terms[i].func->evaluateDeriv(x, tmp);
+            df.addScaled(m_terms[i].factor(), tmp);
+          }
+      if (m_hasidentity)
+        {
+          double diag = shift();
+          for (size_t i = 0; i < m_dimf; i++)
+            df(i,i) += diag;
+        }
+    }
+  };
+
+
+
+
+  // df = jaca*jacb without a temporary matrix, skipping zeros of jaca
+  inline void MultiplyJacobians (MatrixView<double> jaca, MatrixView<double> jacb,
+                                 MatrixView<double> df)
+  {
+    df = 0.0;
+    for (size_t i = 0; i < df.rows(); i++)
+      for (size_t k = 0; k < jaca.cols(); k++)
+        {
+          double aik = jaca(i,k);
+          if (aik == 0.0) continue;
+          for (size_t j = 0; j < df.cols(); j++)
+            df(i,j) += aik * jacb(k,j);
+        }
+  }
 
   // fa(fb)
   class ComposeFunction : public NonlinearFunction
   {
     std::shared_ptr<NonlinearFunction> m_fa, m_fb;
+    Workspace m_ws;
   public:
     ComposeFunction (std::shared_ptr<NonlinearFunction> fa,
                      std::shared_ptr<NonlinearFunction> fb)
       : m_fa(fa), m_fb(fb) { }
 
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { m_fa, m_fb }; }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      return std::make_shared<ComposeFunction>(funcs[0], funcs[1]);
+    }
+    void setTime (double t) override { m_fa->setTime(t); m_fb->setTime(t); }
+    bool isInvariant() const override { return m_fa->isInvariant() || m_fb->isInvariant(); }
+    LINEARITY linearity() const override
+    {
+      if (isInvariant()) return AFFINE;
+      return std::max(m_fa->linearity(), m_fb->linearity());
+    }
+
     size_t dimX() const override { return m_fb->dimX(); }
     size_t dimF() const override { return m_fa->dimF(); }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
     {
-      Vector<> tmp(m_fb->dimF());
+      auto tmp = m_ws.vec(0, m_fb->dimF());
       m_fb->evaluate (x, tmp);
       m_fa->evaluate (tmp, f);
     }
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      auto tmp = m_ws.mat(3, m_fb->dimF(), x.cols());
+      m_fb->evaluateBatch (x, tmp);
+      m_fa->evaluateBatch (tmp, f);
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
-      Vector<> tmp(m_fb->dimF());
-      m_fb->evaluate (x, tmp);
+      auto tmp = m_ws.vec(0, m_fb->dimF());
+      auto jaca = m_ws.mat(1, m_fa->dimF(), m_fa->dimX());
+      auto jacb = m_ws.mat(2, m_fb->dimF(), m_fb->dimX());
+
+      m_fb->evaluateWithDeriv(x, tmp, jacb);
+      m_fa->evaluateDeriv(tmp, jaca);
+      MultiplyJacobians(jaca, jacb, df);
+    }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      auto tmp = m_ws.vec(0, m_fb->dimF());
+      auto jaca = m_ws.mat(1, m_fa->dimF(), m_fa->dimX());
+      auto jacb = m_ws.mat(2, m_fb->dimF(), m_fb->dimX());
 
-      Matrix<double> jaca(m_fa->dimF(), m_fa->dimX());
-      Matrix<double> jacb(m_fb->dimF(), m_fb->dimX());
+      m_fb->evaluateWithDeriv(x, tmp, jacb);
+      m_fa->evaluateWithDeriv(tmp, f, jaca);
+      MultiplyJacobians(jaca, jacb, df);
+    }
+    // chain rule: dfa(fb(x)) * (dfb(x) * v)
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      auto tmp = m_ws.vec(0, m_fb->dimF());
+      auto jbv = m_ws.vec(4, m_fb->dimF());
+      m_fb->evaluate(x, tmp);
+      m_fb->applyDeriv(x, v, jbv);
+      m_fa->applyDeriv(tmp, jbv, Jv);
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      auto tmp = m_ws.vec(0, m_fb->dimF());
+      auto jatw = m_ws.vec(4, m_fa->dimX());
+      m_fb->evaluate(x, tmp);
+      m_fa->applyDerivTranspose(tmp, w, jatw);
+      m_fb->applyDerivTranspose(x, jatw, JTw);
+    }
+
+    SparsityPattern pattern() const override
+    {
+      return MultiplyPatterns(m_fa->pattern(), m_fb->pattern());
+    }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      auto tmp = m_ws.vec(0, m_fb->dimF());
+      m_fb->evaluate (x, tmp);
 
+      auto & jaca = m_ws.sparse(1, *m_fa);
+      auto & jacb = m_ws.sparse(2, *m_fb);
       m_fb->evaluateDeriv(x, jacb);
       m_fa->evaluateDeriv(tmp, jaca);
 
-      df = jaca*jacb;
+      df = 0.0;
+      for (size_t i = 0; i < jaca.height(); i++)
+        for (size_t ka = jaca.firstInRow(i); ka < jaca.firstInRow(i+1); ka++)
+          {
+            size_t k = jaca.colNr(ka);
+            double aik = jaca.value(ka);
+            for (size_t kb = jacb.firstInRow(k); kb < jacb.firstInRow(k+1); kb++)
+              df(i, jacb.colNr(kb)) += aik * jacb.value(kb);
+          }
     }
   };
   
@@ -191,12 +884,284 @@ namespace ASC_ode
   {
     return make_shared<ComposeFunction> (fa, fb);
   }
+
+
+  // Caches the value of an invariant subtree, e.g. rhs(xold) inside a
+  // Newton loop. It is recomputed only after one of the ConstantFunctions
+  // or Parameters below has changed, and its Jacobian is zero.
+  class InvariantFunction : public NonlinearFunction
+  {
+    std::shared_ptr<NonlinearFunction> m_func;
+    std::vector<std::shared_ptr<ConstantFunction>> m_constants;
+    std::vector<std::shared_ptr<Parameter>> m_params;
+    mutable std::vector<size_t> m_versions;
+    mutable std::vector<double> m_paramvals;
+    mutable Vector<> m_value;
+    mutable bool m_valid = false;
+    mutable size_t m_updates = 0;
+    bool m_timedependent;
+    double m_t = 0;
+
+    void collectInputs (std::shared_ptr<NonlinearFunction> func)
+    {
+      if (auto c = std::dynamic_pointer_cast<ConstantFunction>(func))
+        m_constants.push_back(c);
+      if (auto scale = std::dynamic_pointer_cast<ScaleFunction>(func))
+        m_params.push_back(scale->factor());
+      if (auto lin = std::dynamic_pointer_cast<LinearCombinationFunction>(func))
+        for (auto & t : lin->terms())
+          m_params.insert(m_params.end(), t.params.begin(), t.params.end());
+      for (auto & child : func->children())
+        collectInputs(child);
+    }
+
+    bool upToDate() const
+    {
+      if (!m_valid) return false;
+      for (size_t i = 0; i < m_constants.size(); i++)
+        if (m_constants[i]->version() != m_versions[i]) return false;
+      for (size_t i = 0; i < m_params.size(); i++)
+        if (m_params[i]->get() != m_paramvals[i]) return false;
+      return true;
+    }
+
+  public:
+    InvariantFunction (std::shared_ptr<NonlinearFunction> func)
+      : m_func(func), m_value(func->dimF()), m_timedependent(func->isTimeDependent())
+    {
+      collectInputs(m_func);
+      m_versions.resize(m_constants.size());
+      m_paramvals.resize(m_params.size());
+    }
+
+    // for inputs the cache cannot see, e.g. the state of a user function
+    void invalidate() { m_valid = false; }
+    // number of evaluations of the subtree
+    size_t updates() const { return m_updates; }
+
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { m_func }; }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      return std::make_shared<InvariantFunction>(funcs[0]);
+    }
+    // a new time is a new input of a time dependent subtree
+    void setTime (double t) override
+    {
+      if (!m_timedependent) return;
+      if (t != m_t) m_valid = false;
+      m_t = t;
+      m_func->setTime(t);
+    }
+    bool isTimeDependent() const override { return m_timedependent; }
+    bool isInvariant() const override { return true; }
+
+    size_t dimX() const override { return m_func->dimX(); }
+    size_t dimF() const override { return m_func->dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      if (!upToDate())
+        {
+          m_func->evaluate(x, m_value);
+          for (size_t i = 0; i < m_constants.size(); i++)
+            m_versions[i] = m_constants[i]->version();
+          for (size_t i = 0; i < m_params.size(); i++)
+            m_paramvals[i] = m_params[i]->get();
+          m_valid = true;
+          m_updates++;
+        }
+      f = m_value;
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      df = 0.0;
+    }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      Jv = 0.0;
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      JTw = 0.0;
+    }
+
+    SparsityPattern pattern() const override { return SparsityPattern(dimF()); }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 0.0;
+    }
+  };
   
+  // Opt-in memoization of the last evaluation point, e.g. for an expensive
+  // rhs that CrankNicolson evaluates at y and Newton again at its first
+  // iterate y. The key is the exact value of x and the time; call invalidate()
+  // when the function changes for other reasons, e.g. new parameters.
+  class CachedFunction : public NonlinearFunction
+  {
+  public:
+    struct Stats
+    {
+      size_t hits = 0, misses = 0;            // evaluate
+      size_t deriv_hits = 0, deriv_misses = 0;  // evaluateDeriv
+    };
+  private:
+    std::shared_ptr<NonlinearFunction> m_func;
+    mutable Vector<> m_x, m_f, m_xd;
+    mutable std::unique_ptr<Matrix<>> m_df;   // on the first evaluateDeriv
+    mutable bool m_fvalid = false, m_dfvalid = false;
+    mutable Stats m_stats;
+    bool m_timedependent;
+    double m_t = 0;
+
+    static bool same (VectorView<double> a, VectorView<double> b)
+    {
+      for (size_t i = 0; i < a.size(); i++)
+        if (a(i) != b(i)) return false;
+      return true;
+    }
+    bool valueCached (VectorView<double> x) const { return m_fvalid && same(x, m_x); }
+    bool derivCached (VectorView<double> x) const { return m_dfvalid && same(x, m_xd); }
+
+    void storeValue (VectorView<double> x, VectorView<double> f) const
+    {
+      m_x = x;
+      m_f = f;
+      m_fvalid = true;
+    }
+    void storeDeriv (VectorView<double> x, MatrixView<double> df) const
+    {
+      if (!m_df)
+        m_df = std::make_unique<Matrix<>>(dimF(), dimX());
+      m_xd = x;
+      *m_df = df;
+      m_dfvalid = true;
+    }
+
+  public:
+    CachedFunction (std::shared_ptr<NonlinearFunction> func)
+      : m_func(func), m_x(func->dimX()), m_f(func->dimF()), m_xd(func->dimX()),
+        m_timedependent(func->isTimeDependent()) { }
+
+    const Stats & stats() const { return m_stats; }
+    void resetStats() { m_stats = Stats(); }
+    void invalidate() { m_fvalid = m_dfvalid = false; }
+
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { m_func }; }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      return std::make_shared<CachedFunction>(funcs[0]);
+    }
+    // the key is x, values at another time are not reused
+    void setTime (double t) override
+    {
+      if (!m_timedependent) return;
+      if (t != m_t) invalidate();
+      m_t = t;
+      m_func->setTime(t);
+    }
+    bool isTimeDependent() const override { return m_timedependent; }
+    bool isInvariant() const override { return m_func->isInvariant(); }
+    LINEARITY linearity() const override { return m_func->linearity(); }
+
+    size_t dimX() const override { return m_func->dimX(); }
+    size_t dimF() const override { return m_func->dimF(); }
+
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      if (valueCached(x))
+        {
+          m_stats.hits++;
+          f = m_f;
+          return;
+        }
+      m_stats.misses++;
+      m_func->evaluate(x, f);
+      storeValue(x, f);
+    }
+
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      if (derivCached(x))
+        {
+          m_stats.deriv_hits++;
+          df = *m_df;
+          return;
+        }
+      m_stats.deriv_misses++;
+      m_func->evaluateDeriv(x, df);
+      storeDeriv(x, df);
+    }
+
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      bool fcached = valueCached(x), dfcached = derivCached(x);
+      if (fcached && dfcached)
+        {
+          m_stats.hits++;
+          m_stats.deriv_hits++;
+          f = m_f;
+          df = *m_df;
+        }
+      else if (fcached)
+        {
+          f = m_f;
+          m_stats.hits++;
+          evaluateDeriv(x, df);
+        }
+      else if (dfcached)
+        {
+          df = *m_df;
+          m_stats.deriv_hits++;
+          evaluate(x, f);
+        }
+      else
+        {
+          m_stats.misses++;
+          m_stats.deriv_misses++;
+          m_func->evaluateWithDeriv(x, f, df);
+          storeValue(x, f);
+          storeDeriv(x, df);
+        }
+    }
+
+    // not cached
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      m_func->evaluateBatch(x, f);
+    }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      m_func->applyDeriv(x, v, Jv);
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      m_func->applyDerivTranspose(x, w, JTw);
+    }
+    SparsityPattern pattern() const override { return m_func->pattern(); }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      m_func->evaluateDeriv(x, df);
+    }
+  };
+
+  inline auto Cached (std::shared_ptr<NonlinearFunction> func)
+  {
+    return std::make_shared<CachedFunction>(func);
+  }
+
+
   class EmbedFunction : public NonlinearFunction
   {
     std::shared_ptr<NonlinearFunction> m_fa;
     size_t m_firstx, m_dimx, m_firstf, m_dimf;
     size_t m_nextx, m_nextf;
+    Workspace m_ws;
   public:
     EmbedFunction (std::shared_ptr<NonlinearFunction> fa,
                    size_t firstx, size_t dimx,
@@ -206,6 +1171,15 @@ namespace ASC_ode
         m_nextx(m_firstx+m_fa->dimX()), m_nextf(m_firstf+m_fa->dimF())
     { }
 
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { m_fa }; }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      return std::make_shared<EmbedFunction>(funcs[0], m_firstx, m_dimx, m_firstf, m_dimf);
+    }
+    void setTime (double t) override { m_fa->setTime(t); }
+    LINEARITY linearity() const override { return m_fa->linearity(); }
+
     size_t dimX() const override { return m_dimx; }
     size_t dimF() const override { return m_dimf; }
     void evaluate (VectorView<double> x, VectorView<double> f) const override
@@ -213,12 +1187,56 @@ namespace ASC_ode
       f = 0.0;
       m_fa->evaluate(x.range(m_firstx, m_nextx), f.range(m_firstf, m_nextf));
     }
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      f = 0.0;
+      m_fa->evaluateBatch(x.rows(m_firstx, m_nextx), f.rows(m_firstf, m_nextf));
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0;
       m_fa->evaluateDeriv(x.range(m_firstx, m_nextx),
                         df.rows(m_firstf, m_nextf).cols(m_firstx, m_nextx));
     }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      f = 0.0;
+      df = 0.0;
+      m_fa->evaluateWithDeriv(x.range(m_firstx, m_nextx), f.range(m_firstf, m_nextf),
+                              df.rows(m_firstf, m_nextf).cols(m_firstx, m_nextx));
+    }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      Jv = 0.0;
+      m_fa->applyDeriv(x.range(m_firstx, m_nextx), v.range(m_firstx, m_nextx),
+                       Jv.range(m_firstf, m_nextf));
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      JTw = 0.0;
+      m_fa->applyDerivTranspose(x.range(m_firstx, m_nextx), w.range(m_firstf, m_nextf),
+                                JTw.range(m_firstx, m_nextx));
+    }
+
+    SparsityPattern pattern() const override
+    {
+      SparsityPattern pattern(m_dimf);
+      auto pa = m_fa->pattern();
+      for (size_t i = 0; i < pa.size(); i++)
+        for (size_t j : pa[i])
+          pattern[m_firstf+i].push_back(m_firstx+j);
+      return pattern;
+    }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      auto & tmp = m_ws.sparse(0, *m_fa);
+      m_fa->evaluateDeriv(x.range(m_firstx, m_nextx), tmp);
+      df = 0.0;
+      df.addScaled(1, tmp, m_firstf, m_firstx);
+    }
   };
 
   
@@ -237,11 +1255,35 @@ namespace ASC_ode
       f = 0.0;
       f.range(m_first, m_next) = x.range(m_first, m_next);
     }
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      f = 0.0;
+      f.rows(m_first, m_next) = x.rows(m_first, m_next);
+    }
     void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
       df.diag().range(m_first, m_next) = 1;
     }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      evaluate(v, Jv);
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      evaluate(w, JTw);
+    }
+
+    SparsityPattern pattern() const override { return DiagonalPattern(m_size, m_first, m_next); }
+    LINEARITY linearity() const override { return LINEAR; }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 0.0;
+      for (size_t i = m_first; i < m_next; i++)
+        df(i,i) = 1.0;
+    }
   };
 
   
@@ -249,28 +1291,134 @@ namespace ASC_ode
   {
     std::shared_ptr<NonlinearFunction> func;
     size_t num, fdimx, fdimf;
+    Workspace m_ws;
+    bool m_timedependent;
+    Vector<> m_times;                  // time of each stage
+
+    void setStage (size_t i) const
+    {
+      if (m_timedependent) func->setTime(m_times(i));
+    }
   public:
     MultipleFunc (std::shared_ptr<NonlinearFunction> _func, int _num)
-      : func(_func), num(_num)
+      : func(_func), num(_num), m_timedependent(_func->isTimeDependent()), m_times(_num)
     {
       fdimx = func->dimX();
       fdimf = func->dimF();
+      m_times = 0.0;
+    }
+
+    bool isTimeDependent() const override { return m_timedependent; }
+    // the stage times replace the time of setTime
+    void setTime (double t) override { }
+    // func evaluates stage i at time t, ignored for autonomous func
+    void setStageTime (size_t i, double t) { m_times(i) = t; }
+
+    virtual std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { func }; }
+    // the copy keeps the stage times, later setStageTime calls reach only this node
+    virtual std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      auto copy = std::make_shared<MultipleFunc>(*this);
+      copy->func = funcs[0];
+      return copy;
     }
+    virtual LINEARITY linearity() const override { return func->linearity(); }
 
     virtual size_t dimX() const override { return num * fdimx; } 
     virtual size_t dimF() const override{ return num * fdimf; }
+    // all stages go through one evaluateBatch call of func
     virtual void evaluate (VectorView<double> x, VectorView<double> f) const override
     {
+      evaluateBatch(MatrixView<double>(dimX(), 1, 1, x.data()),
+                    MatrixView<double>(dimF(), 1, 1, f.data()));
+    }
+    // stage i of all states becomes the columns i*nb ... (i+1)*nb of the batch of func.
+    // A time dependent func gets one batch per stage.
+    virtual void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      if (m_timedependent)
+        {
+          for (size_t i = 0; i < num; i++)
+            {
+              setStage(i);
+              func->evaluateBatch(x.rows(i*fdimx, (i+1)*fdimx), f.rows(i*fdimf, (i+1)*fdimf));
+            }
+          return;
+        }
+
+      size_t nb = x.cols();
+      auto xs = m_ws.mat(1, fdimx, num*nb);
+      auto fs = m_ws.mat(2, fdimf, num*nb);
       for (size_t i = 0; i < num; i++)
-        func->evaluate(x.range(i*fdimx, (i+1)*fdimx),
-                       f.range(i*fdimf, (i+1)*fdimf));
+        xs.cols(i*nb, (i+1)*nb) = x.rows(i*fdimx, (i+1)*fdimx);
+      func->evaluateBatch(xs, fs);
+      for (size_t i = 0; i < num; i++)
+        f.rows(i*fdimf, (i+1)*fdimf) = fs.cols(i*nb, (i+1)*nb);
     }
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
       for (size_t i = 0; i < num; i++)
-        func->evaluateDeriv(x.range(i*fdimx, (i+1)*fdimx),
-                            df.rows(i*fdimf, (i+1)*fdimf).cols(i*fdimx, (i+1)*fdimx));
+        {
+          setStage(i);
+          func->evaluateDeriv(x.range(i*fdimx, (i+1)*fdimx),
+                              df.rows(i*fdimf, (i+1)*fdimf).cols(i*fdimx, (i+1)*fdimx));
+        }
+    }
+    virtual void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                                    MatrixView<double> df) const override
+    {
+      df = 0.0;
+      for (size_t i = 0; i < num; i++)
+        {
+          setStage(i);
+          func->evaluateWithDeriv(x.range(i*fdimx, (i+1)*fdimx),
+                                  f.range(i*fdimf, (i+1)*fdimf),
+                                  df.rows(i*fdimf, (i+1)*fdimf).cols(i*fdimx, (i+1)*fdimx));
+        }
+    }
+    virtual void applyDeriv (VectorView<double> x, VectorView<double> v,
+                             VectorView<double> Jv) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        {
+          setStage(i);
+          func->applyDeriv(x.range(i*fdimx, (i+1)*fdimx), v.range(i*fdimx, (i+1)*fdimx),
+                           Jv.range(i*fdimf, (i+1)*fdimf));
+        }
+    }
+    virtual void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                                      VectorView<double> JTw) const override
+    {
+      for (size_t i = 0; i < num; i++)
+        {
+          setStage(i);
+          func->applyDerivTranspose(x.range(i*fdimx, (i+1)*fdimx), w.range(i*fdimf, (i+1)*fdimf),
+                                    JTw.range(i*fdimx, (i+1)*fdimx));
+        }
+    }
+
+    virtual SparsityPattern pattern() const override
+    {
+      SparsityPattern pattern(num*fdimf);
+      auto pf = func->pattern();
+      for (size_t i = 0; i < num; i++)
+        for (size_t k = 0; k < fdimf; k++)
+          for (size_t j : pf[k])
+            pattern[i*fdimf+k].push_back(i*fdimx+j);
+      return pattern;
+    }
+    virtual void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      auto & tmp = m_ws.sparse(0, *func);
+      df = 0.0;
+      for (size_t i = 0; i < num; i++)
+        {
+          setStage(i);
+          func->evaluateDeriv(x.range(i*fdimx, (i+1)*fdimx), tmp);
+          df.addScaled(1, tmp, i*fdimf, i*fdimx);
+        }
     }
   };
 
@@ -283,6 +1431,8 @@ namespace ASC_ode
     MatVecFunc (Matrix<> a, size_t n)
       : m_a(a), m_n(n) { }
 
+    virtual LINEARITY linearity() const override { return LINEAR; }
+
     virtual size_t dimX() const override { return m_n*m_a.rows(); } 
     virtual size_t dimF() const override { return m_n*m_a.cols(); }
     virtual void evaluate (VectorView<double> x, VectorView<double> f) const override
@@ -291,6 +1441,14 @@ namespace ASC_ode
       MatrixView<double> mf(m_a.rows(), m_n, m_n, f.data());
       mf = m_a * mx;
     }
+    virtual void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      f = 0.0;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          if (m_a(i,j) != 0.0)
+            f.rows(i*m_n, (i+1)*m_n) += m_a(i,j) * x.rows(j*m_n, (j+1)*m_n);
+    }
     virtual void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
     {
       df = 0.0;
@@ -298,6 +1456,43 @@ namespace ASC_ode
         for (size_t j = 0; j < m_a.cols(); j++)
           df.rows(i*m_n, (i+1)*m_n).cols(j*m_n, (j+1)*m_n).diag() = m_a(i,j);
     }
+    // the function is linear
+    virtual void applyDeriv (VectorView<double> x, VectorView<double> v,
+                             VectorView<double> Jv) const override
+    {
+      evaluate(v, Jv);
+    }
+    virtual void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                                      VectorView<double> JTw) const override
+    {
+      JTw = 0.0;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          if (m_a(i,j) != 0.0)
+            JTw.range(j*m_n, (j+1)*m_n) += m_a(i,j) * w.range(i*m_n, (i+1)*m_n);
+    }
+
+    virtual SparsityPattern pattern() const override
+    {
+      SparsityPattern pattern(dimF());
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          if (m_a(i,j) != 0.0)
+            for (size_t k = 0; k < m_n; k++)
+              pattern[i*m_n+k].push_back(j*m_n+k);
+      for (auto & row : pattern)
+        std::sort(row.begin(), row.end());
+      return pattern;
+    }
+    virtual void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      df = 0.0;
+      for (size_t i = 0; i < m_a.rows(); i++)
+        for (size_t j = 0; j < m_a.cols(); j++)
+          if (m_a(i,j) != 0.0)
+            for (size_t k = 0; k < m_n; k++)
+              df(i*m_n+k, j*m_n+k) = m_a(i,j);
+    }
   };
 
 }
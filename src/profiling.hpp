@@ -0,0 +1,344 @@
+#ifndef PROFILING_HPP
+#define PROFILING_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <iostream>
+#include <iomanip>
+#include <typeinfo>
+#include <new>
+#include <cstdlib>
+
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  // Bytes requested from operator new. Only counted if exactly one
+  // translation unit defines ASC_ODE_COUNT_ALLOCATIONS before including
+  // this header, otherwise it stays 0.
+  inline size_t & AllocatedBytes()
+  {
+    static size_t bytes = 0;
+    return bytes;
+  }
+
+
+  inline std::string TypeName (const NonlinearFunction & func)
+  {
+    std::string name = typeid(func).name();
+#ifdef __GNUG__
+    int status;
+    char * demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status);
+    if (status == 0)
+      {
+        name = demangled;
+        std::free(demangled);
+      }
+#endif
+    if (name.rfind("ASC_ode::", 0) == 0)
+      name = name.substr(9);
+    return name;
+  }
+
+
+  /*
+    Decorator that records calls, cumulative wall time and allocated bytes
+    of evaluate, evaluateDeriv and evaluateWithDeriv of one node. Times and
+    bytes include the children of the node.
+  */
+  class ProfiledFunction : public NonlinearFunction
+  {
+  public:
+    enum KIND { EVALUATE, DERIV, WITHDERIV };
+    static constexpr size_t NUMKINDS = 3;
+
+    struct Stats
+    {
+      size_t calls = 0;
+      double time = 0;
+      size_t bytes = 0;
+    };
+
+  private:
+    std::shared_ptr<NonlinearFunction> m_func;
+    std::string m_label;
+    mutable Stats m_stats[NUMKINDS];
+
+    class Timer
+    {
+      Stats & m_stats;
+      std::chrono::steady_clock::time_point m_start;
+      size_t m_bytes;
+    public:
+      Timer (Stats & stats)
+        : m_stats(stats), m_start(std::chrono::steady_clock::now()), m_bytes(AllocatedBytes()) { }
+      ~Timer ()
+      {
+        m_stats.calls++;
+        m_stats.time += std::chrono::duration<double>(std::chrono::steady_clock::now()-m_start).count();
+        m_stats.bytes += AllocatedBytes()-m_bytes;
+      }
+    };
+
+  public:
+    ProfiledFunction (std::shared_ptr<NonlinearFunction> func, std::string label = "")
+      : m_func(func), m_label(label) { }
+
+    std::shared_ptr<NonlinearFunction> function() const { return m_func; }
+    const std::string & label() const { return m_label; }
+    const Stats & stats (KIND kind) const { return m_stats[kind]; }
+    double totalTime() const
+    {
+      double sum = 0;
+      for (auto & s : m_stats) sum += s.time;
+      return sum;
+    }
+    void reset()
+    {
+      for (auto & s : m_stats) s = Stats();
+    }
+
+    size_t dimX() const override { return m_func->dimX(); }
+    size_t dimF() const override { return m_func->dimF(); }
+    void evaluate (VectorView<double> x, VectorView<double> f) const override
+    {
+      Timer timer(m_stats[EVALUATE]);
+      m_func->evaluate(x, f);
+    }
+    void evaluateDeriv (VectorView<double> x, MatrixView<double> df) const override
+    {
+      Timer timer(m_stats[DERIV]);
+      m_func->evaluateDeriv(x, df);
+    }
+    void evaluateWithDeriv (VectorView<double> x, VectorView<double> f,
+                            MatrixView<double> df) const override
+    {
+      Timer timer(m_stats[WITHDERIV]);
+      m_func->evaluateWithDeriv(x, f, df);
+    }
+
+    // forwarded without recording
+    void evaluateBatch (MatrixView<double> x, MatrixView<double> f) const override
+    {
+      m_func->evaluateBatch(x, f);
+    }
+    void applyDeriv (VectorView<double> x, VectorView<double> v,
+                     VectorView<double> Jv) const override
+    {
+      m_func->applyDeriv(x, v, Jv);
+    }
+    void applyDerivTranspose (VectorView<double> x, VectorView<double> w,
+                              VectorView<double> JTw) const override
+    {
+      m_func->applyDerivTranspose(x, w, JTw);
+    }
+    SparsityPattern pattern() const override { return m_func->pattern(); }
+    void evaluateDeriv (VectorView<double> x, SparseMatrix & df) const override
+    {
+      m_func->evaluateDeriv(x, df);
+    }
+
+    std::vector<std::shared_ptr<NonlinearFunction>> children() const override { return { m_func }; }
+    std::shared_ptr<NonlinearFunction>
+    withChildren (std::vector<std::shared_ptr<NonlinearFunction>> funcs) const override
+    {
+      return std::make_shared<ProfiledFunction>(funcs[0], m_label);
+    }
+    void setTime (double t) override { m_func->setTime(t); }
+    bool isInvariant() const override { return m_func->isInvariant(); }
+    LINEARITY linearity() const override { return m_func->linearity(); }
+  };
+
+
+  inline std::shared_ptr<ProfiledFunction> Profile (std::shared_ptr<NonlinearFunction> func,
+                                                    std::string label = "")
+  {
+    return std::make_shared<ProfiledFunction>(func, label);
+  }
+
+
+  inline std::shared_ptr<NonlinearFunction>
+  Instrument (std::shared_ptr<NonlinearFunction> func,
+              std::map<NonlinearFunction*, std::shared_ptr<NonlinearFunction>> & done)
+  {
+    if (done.count(func.get())) return done[func.get()];
+
+    // the combinators recognize these leaves, wrapping them would cost their shortcuts
+    if (std::dynamic_pointer_cast<IdentityFunction>(func) ||
+        std::dynamic_pointer_cast<ConstantFunction>(func))
+      return done[func.get()] = func;
+
+    auto instrument = [&done] (auto child) { return Instrument(child, done); };
+    auto prof = std::dynamic_pointer_cast<ProfiledFunction>(func);
+    if (prof)
+      {
+        auto node = RebuildChildren(prof->function(), instrument);
+        if (node != prof->function())
+          prof = std::make_shared<ProfiledFunction>(node, prof->label());
+      }
+    else
+      prof = Profile(RebuildChildren(func, instrument));
+    return done[func.get()] = prof;
+  }
+
+  /*
+    Wraps every node of the tree in a ProfiledFunction, nodes already wrapped
+    by Profile(func, label) keep their label. Nodes above a wrapped child are
+    rebuilt, the tree of the caller stays as it is. Instrument after Simplify.
+    Shared nodes share their wrapper.
+  */
+  inline std::shared_ptr<NonlinearFunction> Instrument (std::shared_ptr<NonlinearFunction> func)
+  {
+    std::map<NonlinearFunction*, std::shared_ptr<NonlinearFunction>> done;
+    return Instrument(func, done);
+  }
+
+
+  // annotated tree: calls, inclusive and self time, bytes
+  inline void PrintProfile (std::ostream & ost, std::shared_ptr<NonlinearFunction> func, int depth = 0)
+  {
+    auto prof = std::dynamic_pointer_cast<ProfiledFunction>(func);
+    auto node = prof ? prof->function() : func;
+    std::string name = std::string(2*depth, ' ') + TypeName(*node);
+    if (prof && !prof->label().empty())
+      name += " \"" + prof->label() + "\"";
+    ost << std::left << std::setw(48) << name << std::right;
+
+    if (prof)
+      {
+        double self = prof->totalTime();
+        for (auto & child : node->children())
+          if (auto cprof = std::dynamic_pointer_cast<ProfiledFunction>(child))
+            self -= cprof->totalTime();
+        size_t bytes = 0;
+        for (size_t k = 0; k < ProfiledFunction::NUMKINDS; k++)
+          {
+            auto & s = prof->stats(ProfiledFunction::KIND(k));
+            ost << std::setw(8) << s.calls;
+            bytes += s.bytes;
+          }
+        ost << std::setw(12) << std::setprecision(4) << prof->totalTime()
+            << std::setw(12) << std::setprecision(4) << self
+            << std::setw(12) << bytes;
+      }
+    ost << std::endl;
+
+    for (auto & child : node->children())
+      PrintProfile(ost, child, depth+1);
+  }
+
+  inline void PrintProfileHeader (std::ostream & ost)
+  {
+    ost << std::left << std::setw(48) << "node" << std::right
+        << std::setw(8) << "eval" << std::setw(8) << "deriv" << std::setw(8) << "both"
+        << std::setw(12) << "time [s]" << std::setw(12) << "self [s]"
+        << std::setw(12) << "bytes" << std::endl;
+  }
+
+
+  inline void PrintProfileJSON (std::ostream & ost, std::shared_ptr<NonlinearFunction> func)
+  {
+    static const char * kindnames[] = { "evaluate", "evaluateDeriv", "evaluateWithDeriv" };
+    auto prof = std::dynamic_pointer_cast<ProfiledFunction>(func);
+    auto node = prof ? prof->function() : func;
+
+    ost << "{\"type\": \"" << TypeName(*node) << "\"";
+    if (prof)
+      {
+        ost << ", \"label\": \"" << prof->label() << "\"";
+        for (size_t k = 0; k < ProfiledFunction::NUMKINDS; k++)
+          {
+            auto & s = prof->stats(ProfiledFunction::KIND(k));
+            ost << ", \"" << kindnames[k] << "\": {\"calls\": " << s.calls
+                << ", \"time\": " << s.time << ", \"bytes\": " << s.bytes << "}";
+          }
+      }
+    ost << ", \"children\": [";
+    auto children = node->children();
+    for (size_t i = 0; i < children.size(); i++)
+      {
+        if (i > 0) ost << ", ";
+        PrintProfileJSON(ost, children[i]);
+      }
+    ost << "]}";
+  }
+
+
+  /*
+    Opt-in global mode: after Profiler::global().enable() the time steppers
+    and the Newmark/generalized-alpha solvers instrument their equations
+    and register them here for report() and reportJSON().
+  */
+  class Profiler
+  {
+    bool m_enabled = false;
+    std::vector<std::pair<std::string, std::shared_ptr<NonlinearFunction>>> m_roots;
+  public:
+    static Profiler & global()
+    {
+      static Profiler profiler;
+      return profiler;
+    }
+
+    void enable (bool enabled = true) { m_enabled = enabled; }
+    bool enabled() const { return m_enabled; }
+    void clear() { m_roots.clear(); }
+
+    std::shared_ptr<NonlinearFunction> instrument (std::shared_ptr<NonlinearFunction> func,
+                                                   std::string name)
+    {
+      if (!m_enabled) return func;
+      auto instrumented = Instrument(func);
+      m_roots.emplace_back(name, instrumented);
+      return instrumented;
+    }
+
+    void report (std::ostream & ost) const
+    {
+      for (auto & [name, root] : m_roots)
+        {
+          ost << name << ":" << std::endl;
+          PrintProfileHeader(ost);
+          PrintProfile(ost, root);
+        }
+    }
+
+    void reportJSON (std::ostream & ost) const
+    {
+      ost << "[";
+      for (size_t i = 0; i < m_roots.size(); i++)
+        {
+          if (i > 0) ost << ", ";
+          ost << "{\"name\": \"" << m_roots[i].first << "\", \"tree\": ";
+          PrintProfileJSON(ost, m_roots[i].second);
+          ost << "}";
+        }
+      ost << "]" << std::endl;
+    }
+  };
+
+}
+
+
+#ifdef ASC_ODE_COUNT_ALLOCATIONS
+void * operator new (std::size_t size)
+{
+  ASC_ode::AllocatedBytes() += size;
+  if (void * ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete (void * ptr) noexcept { std::free(ptr); }
+void operator delete (void * ptr, std::size_t) noexcept { std::free(ptr); }
+#endif
+
+#endif
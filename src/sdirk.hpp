@@ -0,0 +1,259 @@
+#ifndef SDIRK_HPP
+#define SDIRK_HPP
+
+#include <cmath>
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+
+#include "timestepper.hpp"
+
+
+namespace ASC_ode
+{
+
+  /*
+    Singly diagonally implicit Runge-Kutta methods: a_ij = 0 for j > i,
+    and the same a_ii = gamma in every implicit stage. Stage i is an
+    implicit Euler step of size gamma tau,
+      Y_i - gamma tau f(t + c_i tau, Y_i) = y + tau sum_{j<i} a_ij k_j,
+    so all stages share the Newton matrix I - gamma tau J. Newton keeps
+    its factorization over the stages and over the steps of equal size.
+    ESDIRK methods have a_11 = 0, an explicit first stage, which is taken
+    from the last stage of the step before if the method is stiffly
+    accurate (b = last row of A).
+    The embedded weights bhat give the error estimate
+      err = tau sum_i (b_i - bhat_i) k_i.
+  */
+  class SDIRK : public TimeStepper
+  {
+  public:
+    enum METHOD
+      {
+        TRBDF2,     // ESDIRK, 3 stages, order 2, L-stable, embedded order 3
+        ESDIRK3,    // Kennedy-Carpenter ESDIRK3(2)4L[2]SA, 4 stages, order 3, L-stable
+        SDIRK4      // Hairer-Wanner, 5 stages, order 4, L-stable, embedded order 3
+      };
+
+    struct Tableau
+    {
+      Matrix<> a;
+      Vector<> b, bhat, c;
+      int order, embeddedOrder;
+    };
+
+    // stiffly accurate methods, b is the last row of A
+    static Tableau builtin (METHOD method)
+    {
+      auto make = [] (std::initializer_list<std::initializer_list<double>> a,
+                      std::initializer_list<double> bhat, std::initializer_list<double> c,
+                      int order, int embedded)
+      {
+        size_t s = c.size();
+        Tableau tab { Matrix<>(s, s), Vector<>(s), Vector<>(s), Vector<>(s), order, embedded };
+        tab.a = 0.0;
+        size_t i = 0;
+        for (auto row : a)
+          {
+            size_t j = 0;
+            for (double aij : row)
+              tab.a(i, j++) = aij;
+            i++;
+          }
+        for (size_t j = 0; j < s; j++)
+          {
+            tab.b(j) = tab.a(s-1, j);
+            tab.bhat(j) = bhat.begin()[j];
+            tab.c(j) = c.begin()[j];
+          }
+        return tab;
+      };
+
+      switch (method)
+        {
+        case TRBDF2:
+          {
+            // Hosea, Shampine: Analysis and implementation of TR-BDF2
+            double g = 2-std::sqrt(2.0), d = g/2, w = std::sqrt(2.0)/4;
+            return make( { { 0 }, { d, d }, { w, w, d } },
+                         { (1-w)/3, (3*w+1)/3, d/3 },
+                         { 0, g, 1 }, 2, 3);
+          }
+        case ESDIRK3:
+          {
+            // Kennedy, Carpenter: Additive Runge-Kutta schemes for
+            // convection-diffusion-reaction equations, the implicit part of ARK3(2)4L[2]SA
+            double g = 1767732205903.0/4055673282236.0;
+            return make( { { 0 },
+                           { g, g },
+                           { 2746238789719.0/10658868560708.0, -640167445237.0/6845629431997.0, g },
+                           { 1471266399579.0/7840856788654.0, -4482444167858.0/7529755066697.0,
+                             11266239266428.0/11593286722821.0, g } },
+                         { 2756255671327.0/12835298489170.0, -10771552573575.0/22201958757719.0,
+                           9247589265047.0/10645013368117.0, 2193209047091.0/5459859503100.0 },
+                         { 0, 2*g, 3.0/5, 1 }, 3, 2);
+          }
+        case SDIRK4:
+          // Hairer, Wanner: Solving ODEs II, Table IV.6.5
+          return make( { { 1.0/4 },
+                         { 1.0/2, 1.0/4 },
+                         { 17.0/50, -1.0/25, 1.0/4 },
+                         { 371.0/1360, -137.0/2720, 15.0/544, 1.0/4 },
+                         { 25.0/24, -49.0/48, 125.0/16, -85.0/12, 1.0/4 } },
+                       { 59.0/48, -17.0/96, 225.0/32, -85.0/12, 0 },
+                       { 1.0/4, 3.0/4, 11.0/20, 1.0/2, 1 }, 4, 3);
+        }
+      throw std::domain_error("SDIRK: unknown method");
+    }
+
+  private:
+    Matrix<> m_a;
+    Vector<> m_b, m_bhat, m_c;
+    int m_order, m_errorder;    // order of y, and of the error estimate
+    int m_stages;
+    int m_n;
+    double m_gamma;
+    bool m_explicit;            // a_11 = 0
+    bool m_fsal;                // k_1 of the next step is k_s
+
+    std::shared_ptr<Parameter> m_gtau;
+    std::shared_ptr<ConstantFunction> m_z;
+    Matrix<> m_k;               // rows are the stage derivatives
+    Vector<> m_z_i, m_y_i, m_err, m_yold, m_ylast;
+    bool m_history = false;     // m_k and m_ylast are from the last step
+
+    bool isLastResult (VectorView<double> y) const
+    {
+      for (size_t i = 0; i < y.size(); i++)
+        if (y(i) != m_ylast(i)) return false;
+      return true;
+    }
+
+  public:
+    SDIRK (std::shared_ptr<NonlinearFunction> rhs, const Tableau & tab)
+      : TimeStepper(rhs), m_a(tab.a), m_b(tab.b), m_bhat(tab.bhat), m_c(tab.c),
+        m_order(tab.order), m_errorder(std::min(tab.order, tab.embeddedOrder)),
+        m_stages(tab.c.size()), m_n(rhs->dimX()),
+        m_k(m_stages, m_n), m_z_i(m_n), m_y_i(m_n), m_err(m_n), m_yold(m_n), m_ylast(m_n)
+    {
+      m_gamma = m_a(m_stages-1, m_stages-1);
+      m_explicit = (m_a(0,0) == 0.0);
+      for (int i = 0; i < m_stages; i++)
+        {
+          for (int j = i+1; j < m_stages; j++)
+            if (m_a(i,j) != 0.0)
+              throw std::domain_error("SDIRK: A is not lower triangular");
+          if (m_a(i,i) != m_gamma && !(i == 0 && m_explicit))
+            throw std::domain_error("SDIRK: the diagonal of A is not constant");
+        }
+      if (m_gamma == 0.0)
+        throw std::domain_error("SDIRK: explicit method");
+      // both weights integrate constants, the estimate is 0 for f = const
+      double sum = 0;
+      for (int j = 0; j < m_stages; j++)
+        sum += m_b(j) - m_bhat(j);
+      if (std::abs(sum) > 1e-12)
+        throw std::domain_error("SDIRK: b and bhat do not have the same sum");
+
+      m_fsal = m_explicit && m_c(0) == 0.0 && m_c(m_stages-1) == 1.0;
+      for (int j = 0; j < m_stages; j++)
+        if (m_b(j) != m_a(m_stages-1, j)) m_fsal = false;
+
+      // scaling of the error estimate until setTolerances
+      m_rtol = m_atol = 1e-6;
+      m_solver = std::make_shared<Newton>(m_n);
+      m_gtau = std::make_shared<Parameter>(0.0);
+      m_z = std::make_shared<ConstantFunction>(m_n);
+      auto ynew = std::make_shared<IdentityFunction>(m_n);
+      m_equ = Simplify(ynew - m_z - m_gtau * m_rhs, m_simplify);
+      m_equ = Profiler::global().instrument(m_equ, "SDIRK");
+    }
+
+    SDIRK (std::shared_ptr<NonlinearFunction> rhs, METHOD method = ESDIRK3)
+      : SDIRK(rhs, builtin(method)) { }
+
+    int order() const { return m_order; }
+    int stages() const { return m_stages; }
+
+    using TimeStepper::DoStep;
+    void DoStep(double t, double tau, VectorView<double> y) override
+    {
+      if (m_gamma*tau != m_gtau->get())
+        m_solver->invalidate();
+      m_gtau->set(m_gamma*tau);
+
+      bool reuse = m_fsal && m_history && t == m_t && isLastResult(y);
+      m_history = false;
+      m_yold = y;
+      for (int i = 0; i < m_stages; i++)
+        {
+          auto k_i = m_k.row(i);
+          if (i == 0 && m_explicit)
+            {
+              if (reuse)
+                k_i = m_k.row(m_stages-1);
+              else
+                {
+                  setRhsTime(t);
+                  m_rhs->evaluate(y, k_i);
+                }
+              continue;
+            }
+
+          m_z_i = y;
+          for (int j = 0; j < i; j++)
+            if (m_a(i,j) != 0.0)
+              m_z_i += (tau*m_a(i,j)) * m_k.row(j);
+          m_z->set(m_z_i);
+
+          // start from the derivative of the stage before
+          m_y_i = m_z_i;
+          if (i > 0)
+            m_y_i += (m_gamma*tau) * m_k.row(i-1);
+          setRhsTime(t + m_c(i)*tau);
+          m_solver->solve(m_equ, m_y_i);
+          k_i = (1/(m_gamma*tau)) * (m_y_i - m_z_i);
+        }
+
+      m_err = 0.0;
+      for (int i = 0; i < m_stages; i++)
+        {
+          y += (tau*m_b(i)) * m_k.row(i);
+          m_err += (tau*(m_b(i)-m_bhat(i))) * m_k.row(i);
+        }
+      m_ylast = y;
+      m_history = true;
+      m_t = t + tau;
+    }
+
+    // error estimate of the last step
+    VectorView<double> errorEstimate() { return m_err; }
+
+    // RMS norm of the error estimate, weighted by atol + rtol max(|y_old|, |y_new|)
+    // with the tolerances of setTolerances.
+    // The step is accepted if it is <= 1.
+    double error() const
+    {
+      double sum = 0;
+      for (int i = 0; i < m_n; i++)
+        {
+          double sc = m_atol + m_rtol * std::max(std::abs(m_yold(i)), std::abs(m_ylast(i)));
+          sum += (m_err(i)/sc) * (m_err(i)/sc);
+        }
+      return std::sqrt(sum / m_n);
+    }
+
+    // next step size from the error of the last step of size tau.
+    // Small increases keep tau, and with it the factorization of Newton.
+    double proposeStep (double tau) const
+    {
+      double err = error();
+      double fac = (err > 0) ? 0.9 * std::pow(err, -1.0/(m_errorder+1)) : 5;
+      if (fac >= 1 && fac <= 1.2) return tau;
+      return tau * std::clamp(fac, 0.2, 5.0);
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef SIMPLIFY_HPP
+#define SIMPLIFY_HPP
+
+#include <algorithm>
+#include <map>
+
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  // number of nodes of the function tree, shared subtrees are counted per use
+  inline size_t CountNodes (std::shared_ptr<NonlinearFunction> func)
+  {
+    size_t cnt = 1;
+    for (auto & child : func->children())
+      cnt += CountNodes(child);
+    return cnt;
+  }
+
+
+  struct SimplifyStats
+  {
+    size_t nodes_before = 0;
+    size_t nodes_after = 0;
+  };
+
+  inline std::ostream & operator<< (std::ostream & ost, const SimplifyStats & stats)
+  {
+    ost << "nodes: " << stats.nodes_before << " -> " << stats.nodes_after;
+    return ost;
+  }
+
+
+  // expand nested Sum/Scale/LinearCombination nodes into terms  fac * params * func
+  inline void CollectLinearTerms (std::shared_ptr<NonlinearFunction> func, double fac,
+                                  std::vector<std::shared_ptr<Parameter>> params,
+                                  std::vector<LinearCombinationFunction::Term> & terms)
+  {
+    if (auto sum = std::dynamic_pointer_cast<SumFunction>(func))
+      {
+        auto children = sum->children();
+        CollectLinearTerms(children[0], fac*sum->factorA(), params, terms);
+        CollectLinearTerms(children[1], fac*sum->factorB(), params, terms);
+      }
+    else if (auto scale = std::dynamic_pointer_cast<ScaleFunction>(func))
+      {
+        params.push_back(scale->factor());
+        CollectLinearTerms(scale->children()[0], fac, params, terms);
+      }
+    else if (auto lin = std::dynamic_pointer_cast<LinearCombinationFunction>(func))
+      {
+        for (auto & t : lin->terms())
+          {
+            auto tparams = params;
+            tparams.insert(tparams.end(), t.params.begin(), t.params.end());
+            CollectLinearTerms(t.func, fac*t.fac, tparams, terms);
+          }
+      }
+    else
+      terms.push_back( { fac, params, func } );
+  }
+
+
+  // add up terms with the same function and the same parameters, drop zero terms
+  inline std::vector<LinearCombinationFunction::Term>
+  MergeLinearTerms (std::vector<LinearCombinationFunction::Term> terms)
+  {
+    std::vector<LinearCombinationFunction::Term> merged;
+    for (auto & t : terms)
+      {
+        std::sort(t.params.begin(), t.params.end());
+        auto same = std::find_if(merged.begin(), merged.end(), [&](auto & m)
+        { return m.func == t.func && m.params == t.params; });
+        if (same != merged.end())
+          same->fac += t.fac;
+        else
+          merged.push_back(t);
+      }
+
+    std::vector<LinearCombinationFunction::Term> nonzero;
+    for (auto & t : merged)
+      if (t.fac != 0.0)
+        nonzero.push_back(t);
+    if (nonzero.empty())  // keep the dimensions of a vanishing sum
+      nonzero.push_back(merged[0]);
+    return nonzero;
+  }
+
+
+  /*
+    Rewrites the function tree for cheaper evaluation:
+    - nested sums and scalings become one LinearCombinationFunction,
+      which skips constant terms and adds identity terms to the diagonal
+      of the Jacobian
+    - Compose with an IdentityFunction is removed
+    - subtrees that do not depend on x are evaluated once and cached
+      in an InvariantFunction
+    Other nodes are rebuilt with their simplified children. The nodes of
+    the given tree are not changed, shared nodes stay shared.
+  */
+  inline std::shared_ptr<NonlinearFunction>
+  Simplify (std::shared_ptr<NonlinearFunction> func,
+            std::map<NonlinearFunction*, std::shared_ptr<NonlinearFunction>> & done)
+  {
+    if (done.count(func.get())) return done[func.get()];
+    auto simplify = [&done] (auto child) { return Simplify(child, done); };
+
+    if (std::dynamic_pointer_cast<ConstantFunction>(func) ||
+        std::dynamic_pointer_cast<InvariantFunction>(func))
+      return done[func.get()] = func;
+    if (func->isInvariant())
+      return done[func.get()] = std::make_shared<InvariantFunction>(func);
+
+    if (std::dynamic_pointer_cast<SumFunction>(func) ||
+        std::dynamic_pointer_cast<ScaleFunction>(func) ||
+        std::dynamic_pointer_cast<LinearCombinationFunction>(func))
+      {
+        std::vector<LinearCombinationFunction::Term> terms;
+        CollectLinearTerms(func, 1, { }, terms);
+        terms = MergeLinearTerms(terms);
+        for (auto & t : terms)
+          t.func = simplify(t.func);
+        if (terms.size() == 1 && terms[0].fac == 1 && terms[0].params.empty())
+          return done[func.get()] = terms[0].func;
+        return done[func.get()] = std::make_shared<LinearCombinationFunction>(terms);
+      }
+
+    if (auto comp = std::dynamic_pointer_cast<ComposeFunction>(func))
+      {
+        auto children = comp->children();
+        if (std::dynamic_pointer_cast<IdentityFunction>(children[0]))
+          return done[func.get()] = simplify(children[1]);
+        if (std::dynamic_pointer_cast<IdentityFunction>(children[1]))
+          return done[func.get()] = simplify(children[0]);
+      }
+
+    return done[func.get()] = RebuildChildren(func, simplify);
+  }
+
+  inline std::shared_ptr<NonlinearFunction> Simplify (std::shared_ptr<NonlinearFunction> func)
+  {
+    std::map<NonlinearFunction*, std::shared_ptr<NonlinearFunction>> done;
+    return Simplify(func, done);
+  }
+
+
+  inline std::shared_ptr<NonlinearFunction> Simplify (std::shared_ptr<NonlinearFunction> func,
+                                                      SimplifyStats & stats)
+  {
+    stats.nodes_before = CountNodes(func);
+    auto simple = Simplify(func);
+    stats.nodes_after = CountNodes(simple);
+    return simple;
+  }
+
+}
+
+#endif
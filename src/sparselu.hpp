@@ -0,0 +1,279 @@
+#ifndef SPARSELU_HPP
+#define SPARSELU_HPP
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <stdexcept>
+
+#include "sparsematrix.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Direct solver for sparse matrices with a structurally symmetric pattern
+    of the kind Newton sees in implicit time stepping, e.g. M - beta dt^2 K.
+    The analysis of the pattern picks the cheaper of
+      BANDED:  LU of the band in the given numbering, n b^2 operations,
+               the fast path for chains and block tridiagonal matrices,
+      GENERAL: LU in a minimum degree ordering, with the fill-in computed
+               by the symbolic elimination.
+    Pivots are taken from the diagonal without row exchanges. A pivot below
+    pivotTolerance times the largest entry of its row in A throws
+    std::domain_error, the caller may fall back to a pivoting solver.
+  */
+  class SparseLU
+  {
+  public:
+    enum METHOD { AUTOMATIC, BANDED, GENERAL };
+
+  private:
+    size_t m_n;
+    METHOD m_method;
+    double m_pivtol = 1e-10;
+    std::vector<double> m_rowmax;       // largest |a_ij| of the rows, in the numbering of the factors
+
+    // BANDED
+    size_t m_bw = 0;                    // bandwidth
+    std::vector<double> m_band;         // row i, column j at i*(2bw+1) + bw+j-i
+
+    // GENERAL, in the permuted numbering
+    std::vector<size_t> m_order;        // new -> old
+    std::vector<size_t> m_inv;          // old -> new
+    std::vector<size_t> m_first, m_cols, m_diagpos;
+    std::vector<double> m_values;
+    mutable std::vector<double> m_y;
+
+    double & band (size_t i, size_t j) { return m_band[i*(2*m_bw+1) + m_bw+j-i]; }
+    double band (size_t i, size_t j) const { return m_band[i*(2*m_bw+1) + m_bw+j-i]; }
+
+    // minimum degree ordering by elimination on the graph of A+A^T,
+    // the neighbours at elimination are the structure of the factors.
+    // Returns the number of multiplications of the factorization.
+    double analyzeGeneral (const SparsityPattern & pattern)
+    {
+      std::vector<std::vector<size_t>> adj(m_n);
+      for (size_t i = 0; i < m_n; i++)
+        for (size_t j : pattern[i])
+          if (i != j)
+            {
+              adj[i].push_back(j);
+              adj[j].push_back(i);
+            }
+      std::set<std::pair<size_t,size_t>> degrees;
+      for (size_t i = 0; i < m_n; i++)
+        {
+          std::sort(adj[i].begin(), adj[i].end());
+          adj[i].erase(std::unique(adj[i].begin(), adj[i].end()), adj[i].end());
+          degrees.insert( { adj[i].size(), i } );
+        }
+
+      std::vector<std::vector<size_t>> structure(m_n);
+      std::vector<size_t> merged;
+      m_order.resize(m_n);
+      m_inv.resize(m_n);
+      double flops = 0;
+      for (size_t k = 0; k < m_n; k++)
+        {
+          size_t v = degrees.begin()->second;
+          degrees.erase(degrees.begin());
+          m_order[k] = v;
+          m_inv[v] = k;
+          auto & nbs = adj[v];
+          flops += double(nbs.size()) * nbs.size();
+
+          // the neighbours of v become a clique
+          for (size_t u : nbs)
+            {
+              degrees.erase( { adj[u].size(), u } );
+              merged.clear();
+              std::set_union(adj[u].begin(), adj[u].end(), nbs.begin(), nbs.end(),
+                             std::back_inserter(merged));
+              merged.erase(std::remove_if(merged.begin(), merged.end(),
+                                          [u,v](size_t w) { return w == u || w == v; }),
+                           merged.end());
+              adj[u].swap(merged);
+              degrees.insert( { adj[u].size(), u } );
+            }
+          structure[k].swap(nbs);
+        }
+
+      // rows of the filled matrix: lower part from the transposed structure,
+      // diagonal, upper part from the structure itself
+      std::vector<std::vector<size_t>> lower(m_n);
+      for (size_t k = 0; k < m_n; k++)
+        {
+          for (auto & j : structure[k])
+            j = m_inv[j];
+          std::sort(structure[k].begin(), structure[k].end());
+          for (size_t i : structure[k])
+            lower[i].push_back(k);
+        }
+
+      m_first.assign(1, 0);
+      m_cols.clear();
+      m_diagpos.resize(m_n);
+      for (size_t i = 0; i < m_n; i++)
+        {
+          m_cols.insert(m_cols.end(), lower[i].begin(), lower[i].end());
+          m_diagpos[i] = m_cols.size();
+          m_cols.push_back(i);
+          m_cols.insert(m_cols.end(), structure[i].begin(), structure[i].end());
+          m_first.push_back(m_cols.size());
+        }
+      m_values.assign(m_cols.size(), 0.0);
+      m_y.resize(m_n);
+      return flops;
+    }
+
+    size_t position (size_t i, size_t j) const
+    {
+      return std::lower_bound(m_cols.begin()+m_first[i], m_cols.begin()+m_first[i+1], j) - m_cols.begin();
+    }
+
+    void checkPivot (size_t k, double piv) const
+    {
+      if (std::abs(piv) <= m_pivtol * m_rowmax[k])
+        throw std::domain_error("SparseLU: zero or tiny pivot " + std::to_string(piv)
+                                + " in row " + std::to_string(k));
+    }
+
+  public:
+    SparseLU (const SparsityPattern & pattern, METHOD method = AUTOMATIC)
+      : m_n(pattern.size()), m_method(method), m_rowmax(pattern.size())
+    {
+      for (size_t i = 0; i < m_n; i++)
+        for (size_t j : pattern[i])
+          m_bw = std::max(m_bw, i > j ? i-j : j-i);
+
+      if (m_method != BANDED)
+        {
+          double flops = analyzeGeneral(pattern);
+          // the indirect addressing of GENERAL costs about twice the band
+          if (m_method == AUTOMATIC)
+            m_method = (double(m_n)*m_bw*m_bw <= 2*flops) ? BANDED : GENERAL;
+        }
+      if (m_method == BANDED)
+        {
+          m_band.assign(m_n*(2*m_bw+1), 0.0);
+          m_values.clear();
+          m_cols.clear();
+        }
+    }
+
+    METHOD method() const { return m_method; }
+    size_t bandwidth() const { return m_bw; }
+    // stored entries of the factors
+    size_t nzeFactor() const { return m_method == BANDED ? m_band.size() : m_values.size(); }
+    // relative size of the smallest accepted pivot
+    void setPivotTolerance (double pivtol) { m_pivtol = pivtol; }
+
+    // a must have the pattern of the analysis
+    void factor (const SparseMatrix & a)
+    {
+      if (m_method == BANDED)
+        {
+          std::fill(m_band.begin(), m_band.end(), 0.0);
+          for (size_t i = 0; i < m_n; i++)
+            {
+              m_rowmax[i] = 0;
+              for (size_t k = a.firstInRow(i); k < a.firstInRow(i+1); k++)
+                {
+                  band(i, a.colNr(k)) = a.value(k);
+                  m_rowmax[i] = std::max(m_rowmax[i], std::abs(a.value(k)));
+                }
+            }
+
+          for (size_t k = 0; k < m_n; k++)
+            {
+              double piv = band(k,k);
+              checkPivot(k, piv);
+              size_t last = std::min(m_n, k+m_bw+1);
+              for (size_t i = k+1; i < last; i++)
+                {
+                  double l = (band(i,k) /= piv);
+                  if (l != 0)
+                    for (size_t j = k+1; j < last; j++)
+                      band(i,j) -= l * band(k,j);
+                }
+            }
+          return;
+        }
+
+      std::fill(m_values.begin(), m_values.end(), 0.0);
+      for (size_t i = 0; i < m_n; i++)
+        {
+          size_t ii = m_inv[i];
+          m_rowmax[ii] = 0;
+          for (size_t k = a.firstInRow(i); k < a.firstInRow(i+1); k++)
+            {
+              m_values[position(ii, m_inv[a.colNr(k)])] = a.value(k);
+              m_rowmax[ii] = std::max(m_rowmax[ii], std::abs(a.value(k)));
+            }
+        }
+
+      // right-looking, the structure of row k is a clique in the filled pattern
+      for (size_t k = 0; k < m_n; k++)
+        {
+          double piv = m_values[m_diagpos[k]];
+          checkPivot(k, piv);
+          size_t ufirst = m_diagpos[k]+1, ulast = m_first[k+1];
+          for (size_t ku = ufirst; ku < ulast; ku++)
+            {
+              size_t i = m_cols[ku];
+              size_t pos = position(i, k);
+              double l = (m_values[pos] /= piv);
+              if (l == 0) continue;
+              for (size_t kj = ufirst; kj < ulast; kj++)
+                {
+                  size_t j = m_cols[kj];
+                  while (m_cols[pos] < j) pos++;
+                  m_values[pos] -= l * m_values[kj];
+                }
+            }
+        }
+    }
+
+    // b <- A^{-1} b
+    void solve (VectorView<double> b) const
+    {
+      if (m_method == BANDED)
+        {
+          for (size_t i = 0; i < m_n; i++)
+            for (size_t j = (i > m_bw ? i-m_bw : 0); j < i; j++)
+              b(i) -= band(i,j) * b(j);
+          for (size_t i = m_n; i-- > 0; )
+            {
+              size_t last = std::min(m_n, i+m_bw+1);
+              for (size_t j = i+1; j < last; j++)
+                b(i) -= band(i,j) * b(j);
+              b(i) /= band(i,i);
+            }
+          return;
+        }
+
+      for (size_t i = 0; i < m_n; i++)
+        {
+          double sum = b(m_order[i]);
+          for (size_t k = m_first[i]; k < m_diagpos[i]; k++)
+            sum -= m_values[k] * m_y[m_cols[k]];
+          m_y[i] = sum;
+        }
+      for (size_t i = m_n; i-- > 0; )
+        {
+          double sum = m_y[i];
+          for (size_t k = m_diagpos[i]+1; k < m_first[i+1]; k++)
+            sum -= m_values[k] * m_y[m_cols[k]];
+          m_y[i] = sum / m_values[m_diagpos[i]];
+        }
+      for (size_t i = 0; i < m_n; i++)
+        b(m_order[i]) = m_y[i];
+    }
+  };
+
+}
+
+#endif
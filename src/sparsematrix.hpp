@@ -0,0 +1,167 @@
+#ifndef SPARSEMATRIX_HPP
+#define SPARSEMATRIX_HPP
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+#include <vector.hpp>
+#include <matrix.hpp>
+
+namespace ASC_ode
+{
+  using namespace nanoblas;
+
+  // row-wise sparsity pattern: sorted column numbers for every row
+  using SparsityPattern = std::vector<std::vector<size_t>>;
+
+  inline SparsityPattern DensePattern (size_t height, size_t width)
+  {
+    SparsityPattern pattern(height);
+    for (auto & row : pattern)
+      for (size_t j = 0; j < width; j++)
+        row.push_back(j);
+    return pattern;
+  }
+
+  inline SparsityPattern DiagonalPattern (size_t n, size_t first, size_t next)
+  {
+    SparsityPattern pattern(n);
+    for (size_t i = first; i < next; i++)
+      pattern[i].push_back(i);
+    return pattern;
+  }
+
+  // union of two patterns of the same height
+  inline SparsityPattern MergePatterns (const SparsityPattern & pa, const SparsityPattern & pb)
+  {
+    SparsityPattern pattern(pa.size());
+    for (size_t i = 0; i < pa.size(); i++)
+      std::set_union(pa[i].begin(), pa[i].end(), pb[i].begin(), pb[i].end(),
+                     std::back_inserter(pattern[i]));
+    return pattern;
+  }
+
+  // pattern of the product A*B
+  inline SparsityPattern MultiplyPatterns (const SparsityPattern & pa, const SparsityPattern & pb)
+  {
+    SparsityPattern pattern(pa.size());
+    for (size_t i = 0; i < pa.size(); i++)
+      {
+        auto & row = pattern[i];
+        for (size_t k : pa[i])
+          row.insert(row.end(), pb[k].begin(), pb[k].end());
+        std::sort(row.begin(), row.end());
+        row.erase(std::unique(row.begin(), row.end()), row.end());
+      }
+    return pattern;
+  }
+
+
+  // matrix in compressed row storage (CSR), the pattern is fixed at construction
+  class SparseMatrix
+  {
+    size_t m_height, m_width;
+    std::vector<size_t> m_firstinrow;
+    std::vector<size_t> m_colnr;
+    std::vector<double> m_values;
+  public:
+    SparseMatrix (const SparsityPattern & pattern, size_t width)
+      : m_height(pattern.size()), m_width(width), m_firstinrow(pattern.size()+1)
+    {
+      m_firstinrow[0] = 0;
+      for (size_t i = 0; i < m_height; i++)
+        m_firstinrow[i+1] = m_firstinrow[i] + pattern[i].size();
+      m_colnr.reserve(m_firstinrow[m_height]);
+      for (auto & row : pattern)
+        m_colnr.insert(m_colnr.end(), row.begin(), row.end());
+      m_values.assign(m_colnr.size(), 0.0);
+    }
+
+    size_t height() const { return m_height; }
+    size_t width() const { return m_width; }
+    size_t nze() const { return m_values.size(); }
+
+    // entries of row i are firstInRow(i) <= k < firstInRow(i+1)
+    size_t firstInRow (size_t i) const { return m_firstinrow[i]; }
+    size_t colNr (size_t k) const { return m_colnr[k]; }
+    double & value (size_t k) { return m_values[k]; }
+    double value (size_t k) const { return m_values[k]; }
+
+    SparsityPattern pattern() const
+    {
+      SparsityPattern pattern(m_height);
+      for (size_t i = 0; i < m_height; i++)
+        pattern[i].assign(m_colnr.begin()+m_firstinrow[i], m_colnr.begin()+m_firstinrow[i+1]);
+      return pattern;
+    }
+
+    // position of entry (i,j) in the value array, or nze() if not in the pattern
+    size_t position (size_t i, size_t j) const
+    {
+      auto first = m_colnr.begin()+m_firstinrow[i];
+      auto last = m_colnr.begin()+m_firstinrow[i+1];
+      auto pos = std::lower_bound(first, last, j);
+      if (pos == last || *pos != j) return nze();
+      return pos-m_colnr.begin();
+    }
+
+    double & operator() (size_t i, size_t j)
+    {
+      size_t pos = position(i, j);
+      if (pos == nze())
+        throw std::domain_error("SparseMatrix: entry not in sparsity pattern");
+      return m_values[pos];
+    }
+
+    double operator() (size_t i, size_t j) const
+    {
+      size_t pos = position(i, j);
+      return (pos == nze()) ? 0.0 : m_values[pos];
+    }
+
+    SparseMatrix & operator= (double val)
+    {
+      std::fill(m_values.begin(), m_values.end(), val);
+      return *this;
+    }
+
+    SparseMatrix & operator*= (double fac)
+    {
+      for (auto & v : m_values) v *= fac;
+      return *this;
+    }
+
+    // this += fac * m2, shifted by (offrow, offcol). The pattern of m2 must be contained.
+    void addScaled (double fac, const SparseMatrix & m2, size_t offrow = 0, size_t offcol = 0)
+    {
+      for (size_t i = 0; i < m2.height(); i++)
+        for (size_t k = m2.firstInRow(i); k < m2.firstInRow(i+1); k++)
+          (*this)(offrow+i, offcol+m2.colNr(k)) += fac * m2.value(k);
+    }
+
+    // y = this * x
+    void mult (VectorView<double> x, VectorView<double> y) const
+    {
+      for (size_t i = 0; i < m_height; i++)
+        {
+          double sum = 0;
+          for (size_t k = m_firstinrow[i]; k < m_firstinrow[i+1]; k++)
+            sum += m_values[k] * x(m_colnr[k]);
+          y(i) = sum;
+        }
+    }
+
+    void toDense (MatrixView<double> m) const
+    {
+      m = 0.0;
+      for (size_t i = 0; i < m_height; i++)
+        for (size_t k = m_firstinrow[i]; k < m_firstinrow[i+1]; k++)
+          m(i, m_colnr[k]) = m_values[k];
+    }
+  };
+
+}
+
+#endif
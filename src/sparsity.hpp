@@ -0,0 +1,183 @@
+#ifndef SPARSITY_HPP
+#define SPARSITY_HPP
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+
+#include "nonlinfunc.hpp"
+
+namespace ASC_ode
+{
+
+  /*
+    Scalar type that records which components of x a value depends on.
+    Evaluating a templated T_evaluate with it gives the sparsity pattern
+    of the Jacobian. It carries no value, so code that branches on values
+    of x does not compile with it and has to provide pattern() by hand.
+  */
+  class SparsityTracer
+  {
+    std::vector<size_t> m_deps;  // sorted
+  public:
+    SparsityTracer () = default;
+    SparsityTracer (double) { }
+    static SparsityTracer Variable (size_t i)
+    {
+      SparsityTracer var;
+      var.m_deps.push_back(i);
+      return var;
+    }
+    const std::vector<size_t> & deps() const { return m_deps; }
+
+    friend SparsityTracer Union (const SparsityTracer & a, const SparsityTracer & b)
+    {
+      SparsityTracer result;
+      std::set_union(a.m_deps.begin(), a.m_deps.end(), b.m_deps.begin(), b.m_deps.end(),
+                     std::back_inserter(result.m_deps));
+      return result;
+    }
+  };
+
+  inline SparsityTracer operator+ (const SparsityTracer & a, const SparsityTracer & b) { return Union(a, b); }
+  inline SparsityTracer operator- (const SparsityTracer & a, const SparsityTracer & b) { return Union(a, b); }
+  inline SparsityTracer operator* (const SparsityTracer & a, const SparsityTracer & b) { return Union(a, b); }
+  inline SparsityTracer operator/ (const SparsityTracer & a, const SparsityTracer & b) { return Union(a, b); }
+  inline SparsityTracer operator- (const SparsityTracer & a) { return a; }
+
+  inline SparsityTracer & operator+= (SparsityTracer & a, const SparsityTracer & b) { return a = Union(a, b); }
+  inline SparsityTracer & operator-= (SparsityTracer & a, const SparsityTracer & b) { return a = Union(a, b); }
+  inline SparsityTracer & operator*= (SparsityTracer & a, const SparsityTracer & b) { return a = Union(a, b); }
+  inline SparsityTracer & operator/= (SparsityTracer & a, const SparsityTracer & b) { return a = Union(a, b); }
+
+  using std::sin;
+  using std::cos;
+  using std::sqrt;
+  using std::exp;
+  using std::log;
+
+  inline SparsityTracer sin (const SparsityTracer & a) { return a; }
+  inline SparsityTracer cos (const SparsityTracer & a) { return a; }
+  inline SparsityTracer sqrt (const SparsityTracer & a) { return a; }
+  inline SparsityTracer exp (const SparsityTracer & a) { return a; }
+  inline SparsityTracer log (const SparsityTracer & a) { return a; }
+
+
+  // pattern of a function with a templated T_evaluate, see AutoDiffFunction
+  template <typename TFUNC>
+  SparsityPattern TracePattern (const TFUNC & func)
+  {
+    size_t n = func.dimX(), m = func.dimF();
+    std::vector<SparsityTracer> x(n), f(m);
+    for (size_t i = 0; i < n; i++)
+      x[i] = SparsityTracer::Variable(i);
+    func.T_evaluate(VectorView<SparsityTracer>(n, x.data()),
+                    VectorView<SparsityTracer>(m, f.data()));
+    SparsityPattern pattern(m);
+    for (size_t i = 0; i < m; i++)
+      pattern[i] = f[i].deps();
+    return pattern;
+  }
+
+
+  // Greedy coloring of the column intersection graph: columns which
+  // share a row get different colors. Columns of one color can be
+  // differentiated together.
+  inline std::vector<size_t> ColorColumns (const SparsityPattern & pattern, size_t width)
+  {
+    std::vector<std::vector<size_t>> colrows(width);
+    for (size_t i = 0; i < pattern.size(); i++)
+      for (size_t j : pattern[i])
+        colrows[j].push_back(i);
+
+    std::vector<size_t> colors(width, width);
+    std::vector<size_t> forbidden(width+1, width);  // forbidden[c] == j: c is used by a neighbour of j
+    for (size_t j = 0; j < width; j++)
+      {
+        for (size_t i : colrows[j])
+          for (size_t k : pattern[i])
+            if (colors[k] < width)
+              forbidden[colors[k]] = j;
+        size_t c = 0;
+        while (forbidden[c] == j) c++;
+        colors[j] = c;
+      }
+    return colors;
+  }
+
+
+  // Jacobian with the given pattern from one evaluation per color
+  class ColoredJacobian
+  {
+    SparsityPattern m_pattern;
+    size_t m_width;
+    std::vector<size_t> m_colors;
+    std::vector<std::vector<size_t>> m_colorcols;
+    Workspace m_ws;
+
+    // central differences, df(i,j) for all (i,j) in the pattern
+    template <typename TMAT>
+    void differences (const NonlinearFunction & func, VectorView<double> x,
+                      TMAT & df, double eps) const
+    {
+      auto xp = m_ws.vec(0, m_width);
+      auto xm = m_ws.vec(1, m_width);
+      auto fp = m_ws.vec(2, m_pattern.size());
+      auto fm = m_ws.vec(3, m_pattern.size());
+      for (size_t c = 0; c < numColors(); c++)
+        {
+          xp = x;
+          xm = x;
+          for (size_t j : m_colorcols[c])
+            {
+              xp(j) += eps;
+              xm(j) -= eps;
+            }
+          func.evaluate(xp, fp);
+          func.evaluate(xm, fm);
+          for (size_t i = 0; i < m_pattern.size(); i++)
+            for (size_t j : m_pattern[i])
+              if (m_colors[j] == c)
+                df(i,j) = (fp(i)-fm(i)) / (2*eps);
+        }
+    }
+
+  public:
+    ColoredJacobian (const SparsityPattern & pattern, size_t width)
+      : m_pattern(pattern), m_width(width), m_colors(ColorColumns(pattern, width))
+    {
+      size_t numcolors = 0;
+      for (size_t c : m_colors)
+        numcolors = std::max(numcolors, c+1);
+      m_colorcols.resize(numcolors);
+      for (size_t j = 0; j < width; j++)
+        m_colorcols[m_colors[j]].push_back(j);
+    }
+
+    ColoredJacobian (const NonlinearFunction & func)
+      : ColoredJacobian(func.pattern(), func.dimX()) { }
+
+    const SparsityPattern & pattern() const { return m_pattern; }
+    size_t width() const { return m_width; }
+    size_t numColors() const { return m_colorcols.size(); }
+    size_t color (size_t j) const { return m_colors[j]; }
+
+    // 2*numColors() evaluations of func
+    void evaluateFD (const NonlinearFunction & func, VectorView<double> x,
+                     MatrixView<double> df, double eps = 1e-6) const
+    {
+      df = 0.0;
+      differences(func, x, df, eps);
+    }
+    void evaluateFD (const NonlinearFunction & func, VectorView<double> x,
+                     SparseMatrix & df, double eps = 1e-6) const
+    {
+      df = 0.0;
+      differences(func, x, df, eps);
+    }
+  };
+
+}
+
+#endif
@@ -5,6 +5,8 @@
 #include <exception>
 
 #include "Newton.hpp"
+#include "simplify.hpp"
+#include "profiling.hpp"
 
 
 namespace ASC_ode
@@ -14,10 +16,50 @@ namespace ASC_ode
   { 
   protected:
     std::shared_ptr<NonlinearFunction> m_rhs;
+    bool m_timedependent;       // a TimeDependentFunction is in m_rhs
+    double m_t = 0;             // time reached by the last step
+    std::shared_ptr<NonlinearFunction> m_equ;    // equation of implicit methods
+    SimplifyStats m_simplify;                    // of m_equ
+    std::shared_ptr<NonlinearSolver> m_solver;   // of implicit methods
+    double m_rtol = 0, m_atol = 0, m_kappa = 0.1;
+    bool m_tolerances = false;  // set by setTolerances, also for a later solver
+
+    // the time of the rhs, also inside m_equ, whose nodes may be rebuilt
+    void setRhsTime (double t)
+    {
+      if (!m_timedependent) return;
+      m_rhs->setTime(t);
+      if (m_equ) m_equ->setTime(t);
+    }
   public:
-    TimeStepper(std::shared_ptr<NonlinearFunction> rhs) : m_rhs(rhs) {}
+    TimeStepper(std::shared_ptr<NonlinearFunction> rhs)
+      : m_rhs(rhs), m_timedependent(rhs->isTimeDependent()) {}
     virtual ~TimeStepper() = default;
-    virtual void DoStep(double tau, VectorView<double> y) = 0;
+    // step from y(t) to y(t+tau)
+    virtual void DoStep(double t, double tau, VectorView<double> y) = 0;
+    // continues at the time reached by the last step, starting at 0
+    void DoStep(double tau, VectorView<double> y) { DoStep(m_t, tau, y); }
+    double time() const { return m_t; }
+    const SimplifyStats & simplifyStats() const { return m_simplify; }
+
+    // implicit methods solve with Newton, unless replaced, e.g. by NewtonKrylov
+    std::shared_ptr<NonlinearSolver> solver() const { return m_solver; }
+    void setSolver (std::shared_ptr<NonlinearSolver> solver)
+    {
+      m_solver = solver;
+      if (m_tolerances) m_solver->setTolerances(m_rtol, m_atol, m_kappa);
+    }
+
+    // error of the implicit solve relative to y, see NonlinearSolver::setTolerances.
+    // Tolerances near the error of the step save the iterations below it.
+    virtual void setTolerances (double rtol, double atol, double kappa = 0.1)
+    {
+      m_rtol = rtol;
+      m_atol = atol;
+      m_kappa = kappa;
+      m_tolerances = true;
+      if (m_solver) m_solver->setTolerances(rtol, atol, kappa);
+    }
   };
 
   class ExplicitEuler : public TimeStepper
@@ -26,38 +68,46 @@ namespace ASC_ode
   public:
     ExplicitEuler(std::shared_ptr<NonlinearFunction> rhs) 
     : TimeStepper(rhs), m_vecf(rhs->dimF()) {}
-    void DoStep(double tau, VectorView<double> y) override
+    using TimeStepper::DoStep;
+    void DoStep(double t, double tau, VectorView<double> y) override
     {
+      setRhsTime(t);
       this->m_rhs->evaluate(y, m_vecf);
       y += tau * m_vecf;
+      m_t = t + tau;
     }
   };
 
   class ImplicitEuler : public TimeStepper
   {
-    std::shared_ptr<NonlinearFunction> m_equ;
     std::shared_ptr<Parameter> m_tau;
     std::shared_ptr<ConstantFunction> m_yold;
   public:
     ImplicitEuler(std::shared_ptr<NonlinearFunction> rhs) 
-    : TimeStepper(rhs), m_tau(std::make_shared<Parameter>(0.0)) 
+    : TimeStepper(rhs), m_tau(std::make_shared<Parameter>(0.0))
     {
+      m_solver = std::make_shared<Newton>(rhs->dimX());
       m_yold = std::make_shared<ConstantFunction>(rhs->dimX());
       auto ynew = std::make_shared<IdentityFunction>(rhs->dimX());
-      m_equ = ynew - m_yold - m_tau * m_rhs;
+      m_equ = Simplify(ynew - m_yold - m_tau * m_rhs, m_simplify);
+      m_equ = Profiler::global().instrument(m_equ, "ImplicitEuler");
     }
 
-    void DoStep(double tau, VectorView<double> y) override
+    using TimeStepper::DoStep;
+    void DoStep(double t, double tau, VectorView<double> y) override
     {
       m_yold->set(y);
+      if (tau != m_tau->get())
+        m_solver->invalidate();
       m_tau->set(tau);
-      NewtonSolver(m_equ, y);
+      setRhsTime(t + tau);
+      m_solver->solve(m_equ, y);
+      m_t = t + tau;
     }
   };
 
   class CrankNicolson : public TimeStepper
   {
-    std::shared_ptr<NonlinearFunction> m_equ;
     std::shared_ptr<Parameter> m_tau_half;
     std::shared_ptr<ConstantFunction> m_yold;
     Vector<> m_vecf;
@@ -67,21 +117,29 @@ namespace ASC_ode
     : TimeStepper(rhs), m_tau_half(std::make_shared<Parameter>(0.0)) 
       , m_vecf(rhs->dimF())
     {
+      m_solver = std::make_shared<Newton>(rhs->dimX());
       m_yold = std::make_shared<ConstantFunction>(rhs->dimX());
       m_fold = std::make_shared<ConstantFunction>(rhs->dimF());
       auto ynew = std::make_shared<IdentityFunction>(rhs->dimX());
-      m_equ = m_yold + m_tau_half * (m_fold + m_rhs) - ynew;
+      m_equ = Simplify(m_yold + m_tau_half * (m_fold + m_rhs) - ynew, m_simplify);
+      m_equ = Profiler::global().instrument(m_equ, "CrankNicolson");
     }
 
-    void DoStep(double tau, VectorView<double> y) override
+    using TimeStepper::DoStep;
+    void DoStep(double t, double tau, VectorView<double> y) override
     {
       m_yold->set(y);
+      if (0.5 * tau != m_tau_half->get())
+        m_solver->invalidate();
       m_tau_half->set(0.5 * tau);
 
+      setRhsTime(t);
       this->m_rhs->evaluate(y, m_vecf);
       m_fold->set(m_vecf);
 
-      NewtonSolver(m_equ, y);
+      setRhsTime(t + tau);
+      m_solver->solve(m_equ, y);
+      m_t = t + tau;
     }
   };
 